@@ -0,0 +1,335 @@
+//! end to end latency of talon itself, on generated projects of different sizes and shapes. every run goes through
+//! the real driver with TALON_TIMINGS set, so besides the wall time the driver and the builder report their phases:
+//!
+//!   driver.cache_check      deciding whether the builder is up to date (compiler version plus input fingerprints)
+//!   driver.compile_builder  compiling build.cc, only when it had to be rebuilt
+//!   driver.execute_builder  the whole builder process, everything below included
+//!   builder.dependencies    looking up (or on a miss building) the prebuilt dependencies in the user cache
+//!   builder.collect_sources source discovery (find_and_collect_files) and compile edges
+//!   builder.write_manifest  generating and writing .talon/build.ninja
+//!   builder.ninja           ninja itself, a no-op or a single recompile plus relink
+//!
+//! usage: cargo run --release -p talon-benchmark -- --talon bin/release/talon --output bench_output.txt
+
+use anyhow::{Context, Result, bail};
+use clap::Parser;
+use serde_json::{Value, json};
+use std::collections::BTreeMap;
+use std::fs::{self, File};
+use std::path::{Path, PathBuf};
+use std::process::{Command, Stdio};
+use std::time::{Instant, SystemTime};
+
+#[derive(Parser)]
+#[command(name = "talon-benchmark")]
+#[command(about = "measures no-op and incremental build latency of talon on generated projects")]
+struct Cli {
+    /// The talon executable under test
+    #[arg(long, default_value = "bin/release/talon")]
+    talon: PathBuf,
+
+    /// Number of source files of the generated projects, one project set per value
+    #[arg(long, value_delimiter = ',', default_values_t = [100, 1000])]
+    sources: Vec<usize>,
+
+    /// Number of headers shared by the sources
+    #[arg(long, default_value_t = 50)]
+    headers: usize,
+
+    /// Samples per measurement, the cold build is only measured once
+    #[arg(long, default_value_t = 10)]
+    runs: usize,
+
+    /// Compiler the generated build scripts select
+    #[arg(long, default_value = "clang", value_parser = ["clang", "gcc"])]
+    compiler: String,
+
+    /// Where the generated projects are created
+    #[arg(long)]
+    work_directory: Option<PathBuf>,
+
+    /// Where the json results are written, stdout when not given
+    #[arg(long)]
+    output: Option<PathBuf>,
+}
+
+#[derive(Clone, Copy)]
+enum Tree {
+    /// every source directly in src/, headers do not include each other
+    Shallow,
+    /// sources spread over nested directories, headers include each other in chains
+    Deep,
+}
+
+#[derive(Clone, Copy)]
+enum Discovery {
+    /// every source listed with add_build_files
+    Explicit,
+    /// add_source_directories("src"), the builder walks the tree on every run
+    Directories,
+}
+
+struct Project {
+    name:      String,
+    directory: PathBuf,
+    sources:   Vec<PathBuf>,
+}
+
+/// microseconds per phase, `total` is the wall time of the talon process
+type Timings = BTreeMap<String, Vec<u64>>;
+
+/// directories per level and nesting depth of Tree::Deep, and the length of its header include chains
+const DEEP_FANOUT: usize = 4;
+const DEEP_LEVELS: usize = 4;
+const HEADER_CHAIN: usize = 8;
+
+fn main() -> Result<()> {
+    let cli = Cli::parse();
+
+    let talon = fs::canonicalize(&cli.talon)
+        .with_context(|| format!("talon executable not found: {}, build it first", cli.talon.display()))?;
+    let work_directory = cli.work_directory.clone().unwrap_or_else(|| std::env::temp_dir().join("talon-benchmark"));
+    let runs = cli.runs.max(1);
+
+    eprintln!("measuring driver startup");
+    let startup = measure_startup(&talon, runs)?;
+
+    let mut projects = Vec::new();
+    for &source_count in &cli.sources {
+        for tree in [Tree::Shallow, Tree::Deep] {
+            for discovery in [Discovery::Explicit, Discovery::Directories] {
+                let project =
+                    generate_project(&work_directory, source_count, cli.headers, tree, discovery, &cli.compiler)?;
+                eprintln!("benchmarking {}", project.name);
+
+                let scenarios = benchmark_project(&talon, &project, runs)?;
+                projects.push(json!({
+                    "name": project.name,
+                    "sources": source_count,
+                    "headers": cli.headers,
+                    "tree": match tree { Tree::Shallow => "shallow", Tree::Deep => "deep" },
+                    "discovery": match discovery { Discovery::Explicit => "explicit", Discovery::Directories => "directories" },
+                    "scenarios": scenarios,
+                }));
+            }
+        }
+    }
+
+    let results = json!({
+        "talon": talon.display().to_string(),
+        "compiler": cli.compiler,
+        "runs": runs,
+        "unit": "microseconds",
+        "startup": summarize(&startup),
+        "projects": projects,
+    });
+
+    let text = serde_json::to_string_pretty(&results)?;
+    match &cli.output {
+        Some(path) => fs::write(path, text + "\n").with_context(|| format!("failed to write {}", path.display()))?,
+        None => println!("{}", text),
+    }
+
+    Ok(())
+}
+
+fn generate_project(
+    work_directory: &Path,
+    source_count: usize,
+    header_count: usize,
+    tree: Tree,
+    discovery: Discovery,
+    compiler: &str,
+) -> Result<Project> {
+    let name = format!(
+        "{}-{}-{}",
+        match tree {
+            Tree::Shallow => "shallow",
+            Tree::Deep => "deep",
+        },
+        match discovery {
+            Discovery::Explicit => "explicit",
+            Discovery::Directories => "directories",
+        },
+        source_count
+    );
+
+    let directory = work_directory.join(&name);
+    if directory.exists() {
+        fs::remove_dir_all(&directory).with_context(|| format!("failed to remove {}", directory.display()))?;
+    }
+
+    let header_count = header_count.max(1);
+    fs::create_dir_all(directory.join("include/generated"))?;
+    for header in 0..header_count {
+        let chained = matches!(tree, Tree::Deep) && header % HEADER_CHAIN != 0;
+        let (include, previous) = if chained {
+            (format!("#include \"generated/header_{}.hpp\"\n", header - 1), format!(" + header_{}_value()", header - 1))
+        } else {
+            (String::new(), String::new())
+        };
+
+        let text = format!(
+            "#pragma once\n{}\ninline int header_{}_value()\n{{\n    return {}{};\n}}\n",
+            include, header, header, previous
+        );
+        fs::write(directory.join(format!("include/generated/header_{}.hpp", header)), text)?;
+    }
+
+    let mut sources = vec![PathBuf::from("src/main.cpp")];
+    for source in 0..source_count {
+        let relative = match tree {
+            Tree::Shallow => PathBuf::from(format!("src/source_{}.cpp", source)),
+            Tree::Deep => {
+                let mut path = PathBuf::from("src");
+                let mut bucket = source;
+                for level in 0..DEEP_LEVELS {
+                    path.push(format!("level{}_{}", level, bucket % DEEP_FANOUT));
+                    bucket /= DEEP_FANOUT;
+                }
+
+                path.join(format!("source_{}.cpp", source))
+            }
+        };
+
+        let headers = [source % header_count, (source * 7 + 3) % header_count, (source * 13 + 5) % header_count];
+        let mut text = String::new();
+        for header in headers {
+            text += &format!("#include \"generated/header_{}.hpp\"\n", header);
+        }
+
+        text += &format!(
+            "\nint source_{}_value()\n{{\n    return header_{}_value() + header_{}_value() + header_{}_value();\n}}\n",
+            source, headers[0], headers[1], headers[2]
+        );
+
+        let path = directory.join(&relative);
+        fs::create_dir_all(path.parent().context("source has no parent directory")?)?;
+        fs::write(path, text)?;
+        sources.push(relative);
+    }
+
+    fs::write(directory.join("src/main.cpp"), "int main()\n{\n    return 0;\n}\n")?;
+
+    let mut build_script = String::from("#include <talon/talon.hpp>\n\nauto build(talon::arguments) -> void\n{\n");
+    build_script += "    auto workspace = talon::workspace{};\n";
+    build_script += &format!("    workspace.options.compiler = talon::{};\n", compiler);
+    build_script += "    workspace.add_includes(\"include\");\n";
+    match discovery {
+        Discovery::Explicit => {
+            for source in &sources {
+                build_script += &format!("    workspace.add_build_files(\"{}\");\n", source.display());
+            }
+        }
+        Discovery::Directories => build_script += "    workspace.add_source_directories(\"src\");\n",
+    }
+    build_script += "    workspace.build();\n}\n";
+    fs::write(directory.join("build.cc"), build_script)?;
+
+    Ok(Project { name, directory, sources })
+}
+
+fn measure_startup(talon: &Path, runs: usize) -> Result<Vec<u64>> {
+    let mut samples = Vec::with_capacity(runs);
+    for _ in 0..runs {
+        let started = Instant::now();
+        let status = Command::new(talon).arg("--version").stdout(Stdio::null()).status()?;
+        samples.push(started.elapsed().as_micros() as u64);
+
+        if !status.success() {
+            bail!("talon --version failed with {}", status);
+        }
+    }
+
+    Ok(samples)
+}
+
+/// one `talon build`, returns its wall time and the phases it reported
+fn timed_build(talon: &Path, project: &Project, timings: &mut Timings) -> Result<()> {
+    let timings_path = project.directory.join("timings.txt");
+    _ = fs::remove_file(&timings_path);
+
+    let started = Instant::now();
+    let output = Command::new(talon)
+        .arg("build")
+        .current_dir(&project.directory)
+        .env("TALON_TIMINGS", &timings_path)
+        .stdin(Stdio::null())
+        .output()
+        .context("failed to execute talon")?;
+    let total = started.elapsed();
+
+    if !output.status.success() {
+        eprintln!("{}{}", String::from_utf8_lossy(&output.stdout), String::from_utf8_lossy(&output.stderr));
+        bail!("talon build failed in {}", project.directory.display());
+    }
+
+    timings.entry("total".to_string()).or_default().push(total.as_micros() as u64);
+
+    let text = fs::read_to_string(&timings_path).unwrap_or_default();
+    for line in text.lines() {
+        let Some((phase, microseconds)) = line.split_once('\t') else { continue };
+        if let Ok(microseconds) = microseconds.trim().parse() {
+            timings.entry(phase.to_string()).or_default().push(microseconds);
+        }
+    }
+
+    Ok(())
+}
+
+/// bumps the modification time, the content stays the same so only the timestamp tells ninja about it
+fn touch(path: &Path, now: SystemTime) -> Result<()> {
+    File::options()
+        .write(true)
+        .open(path)
+        .and_then(|file| file.set_modified(now))
+        .with_context(|| format!("failed to touch {}", path.display()))
+}
+
+fn benchmark_project(talon: &Path, project: &Project, runs: usize) -> Result<Value> {
+    // cold includes compiling the builder and every source, it is measured once
+    let mut cold = Timings::new();
+    timed_build(talon, project, &mut cold)?;
+
+    let mut noop = Timings::new();
+    for _ in 0..runs {
+        timed_build(talon, project, &mut noop)?;
+    }
+
+    // a different source every run, so the measurement does not hinge on one file (or its headers) being cheap
+    let mut touch_source = Timings::new();
+    for run in 0..runs {
+        let source = &project.sources[run % project.sources.len()];
+        touch(&project.directory.join(source), SystemTime::now())?;
+        timed_build(talon, project, &mut touch_source)?;
+    }
+
+    Ok(json!({
+        "cold": summarize_phases(&cold),
+        "noop": summarize_phases(&noop),
+        "touch_source": summarize_phases(&touch_source),
+    }))
+}
+
+fn summarize(samples: &[u64]) -> Value {
+    let mut sorted = samples.to_vec();
+    sorted.sort_unstable();
+
+    let middle = sorted.len() / 2;
+    let median = if sorted.len() % 2 == 0 { (sorted[middle - 1] + sorted[middle]) / 2 } else { sorted[middle] };
+    let mean = sorted.iter().sum::<u64>() / sorted.len() as u64;
+
+    json!({
+        "samples": sorted.len(),
+        "min": sorted[0],
+        "median": median,
+        "mean": mean,
+        "max": sorted[sorted.len() - 1],
+    })
+}
+
+fn summarize_phases(timings: &Timings) -> Value {
+    let phases: serde_json::Map<String, Value> =
+        timings.iter().map(|(phase, samples)| (phase.clone(), summarize(samples))).collect();
+    Value::Object(phases)
+}
@@ -0,0 +1,62 @@
+use anyhow::{Context, Result, bail};
+use log::trace;
+use std::path::{Path, PathBuf};
+use std::process::Command;
+
+/// resolves the arguments of `--affected` into paths relative to the project root, every argument is either a file
+/// (relative to the directory talon was invoked from) or a git ref to diff the working tree against
+pub fn resolve_changed_files(
+    inputs: &[String],
+    invocation_directory: &Path,
+    project_root: &Path,
+) -> Result<Vec<String>> {
+    let mut changed_files = Vec::new();
+
+    for input in inputs {
+        let candidate = invocation_directory.join(input);
+        if candidate.exists() {
+            trace!("affected input '{}' is a file", input);
+            changed_files.push(relative_to_root(&candidate, project_root)?);
+            continue;
+        }
+
+        trace!("affected input '{}' is not a file, treating it as a git ref", input);
+        changed_files.extend(git_changed_files(input, project_root)?);
+    }
+
+    changed_files.sort();
+    changed_files.dedup();
+    Ok(changed_files)
+}
+
+/// files that differ from the ref plus untracked ones, a source added since then is not in the diff. talon's own
+/// outputs are left out in case the project does not ignore them
+fn git_changed_files(git_ref: &str, project_root: &Path) -> Result<Vec<String>> {
+    let changed = git_file_list(&["diff", "--name-only", "--relative", git_ref], project_root)
+        .with_context(|| format!("'{}' is neither a file nor a git ref", git_ref))?;
+    let untracked =
+        git_file_list(&["ls-files", "--others", "--exclude-standard", "--", ".", ":!build", ":!.talon"], project_root)?;
+
+    Ok(changed.into_iter().chain(untracked).collect())
+}
+
+fn git_file_list(args: &[&str], project_root: &Path) -> Result<Vec<String>> {
+    let output = Command::new("git").args(args).current_dir(project_root).output().context("failed to execute git")?;
+    if !output.status.success() {
+        bail!("git {} failed: {}", args.join(" "), String::from_utf8_lossy(&output.stderr).trim());
+    }
+
+    Ok(String::from_utf8_lossy(&output.stdout).lines().filter(|line| !line.is_empty()).map(str::to_string).collect())
+}
+
+fn relative_to_root(path: &Path, project_root: &Path) -> Result<String> {
+    let absolute: PathBuf =
+        path.canonicalize().with_context(|| format!("failed to resolve path: {}", path.display()))?;
+    let root = project_root.canonicalize()?;
+
+    let relative = absolute
+        .strip_prefix(&root)
+        .with_context(|| format!("'{}' is not inside of the project", absolute.display()))?;
+
+    Ok(relative.to_string_lossy().replace('\\', "/"))
+}
@@ -0,0 +1,557 @@
+use anyhow::{Context, Result, bail};
+use log::{debug, trace, warn};
+use owo_colors::OwoColorize;
+use std::collections::BTreeMap;
+use std::fs;
+use std::io::ErrorKind;
+use std::path::{Path, PathBuf};
+use std::process::{Command, Output};
+
+/// written by the builder, one `name<tab>format<tab>executable` line per benchmark target
+const BENCHMARK_MANIFEST: &str = ".talon/benchmarks.txt";
+/// one `<revision>.txt` per benchmarked revision, every line is `target/benchmark<tab>samples in nanoseconds`
+const BENCHMARK_DIRECTORY: &str = ".talon/bench";
+/// fewer samples than this can not reach any useful significance level
+const MINIMUM_SAMPLES: usize = 5;
+
+pub struct BenchOptions {
+    /// how often every benchmark executable is started, each run adds one sample per benchmark
+    pub repetitions: usize,
+    /// core the benchmarks are pinned to, the last one available when not given
+    pub cpu:         Option<usize>,
+    pub pin:         bool,
+    pub filter:      Option<String>,
+    /// revision (or name of stored results) the run is compared against
+    pub baseline:    Option<String>,
+    /// largest p-value still counted as a real change
+    pub alpha:       f64,
+    /// median changes below this many percent are never reported, however significant
+    pub threshold:   f64,
+}
+
+#[derive(Clone, Copy, PartialEq, Debug)]
+enum Format {
+    Lines,
+    GoogleBenchmark,
+}
+
+struct BenchmarkExecutable {
+    name:   String,
+    format: Format,
+    path:   PathBuf,
+}
+
+/// samples in nanoseconds, keyed by `target/benchmark`
+type Samples = BTreeMap<String, Vec<f64>>;
+
+pub fn run_benchmarks(options: &BenchOptions) -> Result<()> {
+    let executables = read_manifest(Path::new(BENCHMARK_MANIFEST))?;
+    if executables.is_empty() {
+        println!("no benchmark targets declared in the workspace");
+        return Ok(());
+    }
+
+    // read before anything gets stored, benchmarking the baseline revision again would overwrite it otherwise
+    let baseline_samples = match &options.baseline {
+        Some(baseline) => Some(load_samples(&resolve_baseline(baseline)?)?),
+        None => None,
+    };
+
+    let cpu = if options.pin { options.cpu.or_else(last_allowed_cpu) } else { None };
+    match cpu {
+        Some(cpu) => println!(
+            "running {} benchmark target(s), {} time(s) each, pinned to cpu {}",
+            executables.len(),
+            options.repetitions,
+            cpu
+        ),
+        None => println!("running {} benchmark target(s), {} time(s) each", executables.len(), options.repetitions),
+    }
+
+    fs::create_dir_all(BENCHMARK_DIRECTORY)?;
+
+    let mut samples = Samples::new();
+    for executable in &executables {
+        for repetition in 0..options.repetitions {
+            trace!("running {} ({}/{})", executable.name, repetition + 1, options.repetitions);
+
+            for (benchmark, nanoseconds) in run_executable(executable, cpu, options.filter.as_deref())? {
+                samples.entry(format!("{}/{}", executable.name, benchmark)).or_default().push(nanoseconds);
+            }
+        }
+    }
+
+    // lines executables can not be told what to run, their results are filtered here
+    if let Some(filter) = &options.filter {
+        samples.retain(|id, _| id.contains(filter.as_str()));
+    }
+
+    if samples.is_empty() {
+        bail!("the benchmark executables reported no results");
+    }
+
+    // a filtered run only replaces what it measured, later comparisons against this revision still see the rest
+    let revision = current_revision();
+    let results = results_path(&revision);
+    let mut stored = match &options.filter {
+        Some(_) if results.exists() => load_samples(&results)?,
+        _ => Samples::new(),
+    };
+
+    stored.extend(samples.iter().map(|(id, values)| (id.clone(), values.clone())));
+    store_samples(&results, &stored)?;
+
+    let (Some(baseline), Some(baseline_samples)) = (&options.baseline, baseline_samples) else {
+        print_samples(&samples);
+        println!("\nresults stored as {}", revision);
+        return Ok(());
+    };
+
+    let regressions = compare(&baseline_samples, &samples, options);
+    println!("\nresults stored as {}, compared against {}", revision, baseline);
+
+    if regressions > 0 {
+        bail!("{} benchmark(s) regressed against {}", regressions, baseline);
+    }
+
+    Ok(())
+}
+
+fn read_manifest(path: &Path) -> Result<Vec<BenchmarkExecutable>> {
+    let text = fs::read_to_string(path).with_context(|| format!("failed to read {}", path.display()))?;
+
+    let mut executables = Vec::new();
+    for line in text.lines().filter(|line| !line.trim().is_empty()) {
+        let mut fields = line.split('\t');
+        let (Some(name), Some(format), Some(executable)) = (fields.next(), fields.next(), fields.next()) else {
+            warn!("malformed benchmark manifest line: {}", line);
+            continue;
+        };
+
+        let format = match format {
+            "google_benchmark" => Format::GoogleBenchmark,
+            _ => Format::Lines,
+        };
+
+        executables.push(BenchmarkExecutable { name: name.to_string(), format, path: PathBuf::from(executable) });
+    }
+
+    Ok(executables)
+}
+
+/// the highest core in our affinity mask, the first ones tend to handle most interrupts
+fn last_allowed_cpu() -> Option<usize> {
+    if !cfg!(target_os = "linux") {
+        return None;
+    }
+
+    let status = fs::read_to_string("/proc/self/status").ok()?;
+    let list = status.lines().find_map(|line| line.strip_prefix("Cpus_allowed_list:"))?;
+    let last_range = list.trim().rsplit(',').next()?;
+    last_range.rsplit('-').next()?.trim().parse().ok()
+}
+
+fn execute(executable: &BenchmarkExecutable, arguments: &[String], cpu: Option<usize>) -> Result<Output> {
+    if let Some(cpu) = cpu {
+        let pinned =
+            Command::new("taskset").arg("-c").arg(cpu.to_string()).arg(&executable.path).args(arguments).output();
+        match pinned {
+            Err(err) if err.kind() == ErrorKind::NotFound => {
+                warn!("taskset not found, running {} unpinned", executable.name)
+            }
+            output => return output.with_context(|| format!("failed to execute: {}", executable.path.display())),
+        }
+    }
+
+    Command::new(&executable.path)
+        .args(arguments)
+        .output()
+        .with_context(|| format!("failed to execute: {}", executable.path.display()))
+}
+
+fn run_executable(
+    executable: &BenchmarkExecutable,
+    cpu: Option<usize>,
+    filter: Option<&str>,
+) -> Result<Vec<(String, f64)>> {
+    let report_path = Path::new(BENCHMARK_DIRECTORY).join(format!("{}.json", executable.name));
+    let mut arguments = Vec::new();
+    if executable.format == Format::GoogleBenchmark {
+        // a file rather than stdout, so whatever the benchmarks print themselves can not break the json
+        arguments.push(format!("--benchmark_out={}", report_path.display()));
+        arguments.push("--benchmark_out_format=json".to_string());
+
+        if let Some(regex) = filter.and_then(|filter| google_benchmark_filter(&executable.name, filter)) {
+            arguments.push(format!("--benchmark_filter={}", regex));
+        }
+
+        // nothing matching the filter leaves no report, a stale one must not be read instead
+        _ = fs::remove_file(&report_path);
+    }
+
+    let output = execute(executable, &arguments, cpu)?;
+    if !output.status.success() {
+        eprintln!("{}", String::from_utf8_lossy(&output.stderr).trim_end());
+        bail!("{} exited with {}", executable.name, output.status);
+    }
+
+    let results = match executable.format {
+        Format::Lines => parse_lines(&String::from_utf8_lossy(&output.stdout)),
+        Format::GoogleBenchmark if filter.is_some() && !report_path.exists() => Vec::new(),
+        Format::GoogleBenchmark => {
+            let report = fs::read_to_string(&report_path)
+                .with_context(|| format!("{} wrote no google benchmark report", executable.name))?;
+            parse_google_benchmark(&report)?
+        }
+    };
+
+    debug!("{} reported {} result(s)", executable.name, results.len());
+    Ok(results)
+}
+
+/// `--filter` is a substring of `target/benchmark`, google benchmark matches a regex against the benchmark name
+/// alone. the filter either lies within the name, or starts in `target/` and continues at the start of the name.
+/// none when the filter lies within `target/`, then every benchmark of the executable matches
+fn google_benchmark_filter(target: &str, filter: &str) -> Option<String> {
+    let prefix = format!("{}/", target);
+    if prefix.contains(filter) {
+        return None;
+    }
+
+    let escape = |text: &str| -> String {
+        let mut escaped = String::with_capacity(text.len());
+        for character in text.chars() {
+            if "\\^$.|?*+()[]{}".contains(character) {
+                escaped.push('\\');
+            }
+
+            escaped.push(character);
+        }
+
+        escaped
+    };
+
+    let mut alternatives = vec![escape(filter)];
+    for split in (1..filter.len()).filter(|&split| filter.is_char_boundary(split)) {
+        let (head, tail) = filter.split_at(split);
+        if prefix.ends_with(head) {
+            alternatives.push(format!("^{}", escape(tail)));
+        }
+    }
+
+    Some(alternatives.join("|"))
+}
+
+fn unit_to_nanoseconds(unit: &str) -> Option<f64> {
+    match unit {
+        "ns" => Some(1.0),
+        "us" => Some(1e3),
+        "ms" => Some(1e6),
+        "s" => Some(1e9),
+        _ => None,
+    }
+}
+
+/// `bench <name> <value> <ns|us|ms|s>`, everything else on stdout is ignored
+fn parse_lines(stdout: &str) -> Vec<(String, f64)> {
+    let mut results = Vec::new();
+    for line in stdout.lines() {
+        let fields: Vec<&str> = line.split_whitespace().collect();
+        let [keyword, name, value, unit] = fields[..] else { continue };
+        if keyword != "bench" {
+            continue;
+        }
+
+        match (value.parse::<f64>(), unit_to_nanoseconds(unit)) {
+            (Ok(value), Some(scale)) => results.push((name.to_string(), value * scale)),
+            _ => warn!("malformed benchmark line: {}", line),
+        }
+    }
+
+    results
+}
+
+/// takes the real time of every iteration run, aggregates (mean, median, ...) are recomputed from the samples
+fn parse_google_benchmark(report: &str) -> Result<Vec<(String, f64)>> {
+    let report: serde_json::Value = serde_json::from_str(report).context("malformed google benchmark report")?;
+    let benchmarks = report["benchmarks"].as_array().context("google benchmark report has no benchmarks")?;
+
+    let mut results = Vec::new();
+    for benchmark in benchmarks {
+        if benchmark["run_type"].as_str() == Some("aggregate") || benchmark["error_occurred"].as_bool() == Some(true) {
+            continue;
+        }
+
+        let (Some(name), Some(real_time)) = (benchmark["name"].as_str(), benchmark["real_time"].as_f64()) else {
+            continue;
+        };
+
+        let scale = unit_to_nanoseconds(benchmark["time_unit"].as_str().unwrap_or("ns")).unwrap_or(1.0);
+        results.push((name.to_string(), real_time * scale));
+    }
+
+    Ok(results)
+}
+
+fn git_output(arguments: &[&str]) -> Option<String> {
+    let output = Command::new("git").args(arguments).output().ok()?;
+    if !output.status.success() {
+        return None;
+    }
+
+    Some(String::from_utf8_lossy(&output.stdout).trim().to_string())
+}
+
+/// the abbreviated commit, uncommitted changes to tracked files get a -dirty suffix so they never overwrite the
+/// results of the commit itself
+fn current_revision() -> String {
+    let Some(commit) = git_output(&["rev-parse", "--short=12", "HEAD"]) else {
+        return "working-tree".to_string();
+    };
+
+    let dirty = git_output(&["status", "--porcelain", "--untracked-files=no"]).is_some_and(|status| !status.is_empty());
+    if dirty { format!("{}-dirty", commit) } else { commit }
+}
+
+fn results_path(revision: &str) -> PathBuf {
+    Path::new(BENCHMARK_DIRECTORY).join(format!("{}.txt", revision.replace(['/', '\\'], "_")))
+}
+
+/// either the name of stored results (e.g. `abc123-dirty`) or anything git resolves to a commit (`main`, `HEAD~1`)
+fn resolve_baseline(baseline: &str) -> Result<PathBuf> {
+    let stored = results_path(baseline);
+    if stored.exists() {
+        return Ok(stored);
+    }
+
+    if let Some(commit) = git_output(&["rev-parse", "--short=12", &format!("{}^{{commit}}", baseline)]) {
+        let stored = results_path(&commit);
+        if stored.exists() {
+            return Ok(stored);
+        }
+    }
+
+    bail!("no stored results for '{}', check it out and run talon bench first", baseline)
+}
+
+fn store_samples(path: &Path, samples: &Samples) -> Result<()> {
+    let mut text = String::new();
+    for (id, values) in samples {
+        let values: Vec<String> = values.iter().map(|value| format!("{:.1}", value)).collect();
+        text += &format!("{}\t{}\n", id, values.join(" "));
+    }
+
+    fs::write(path, text).with_context(|| format!("failed to write {}", path.display()))
+}
+
+fn load_samples(path: &Path) -> Result<Samples> {
+    let text = fs::read_to_string(path).with_context(|| format!("failed to read {}", path.display()))?;
+
+    let mut samples = Samples::new();
+    for line in text.lines() {
+        let Some((id, values)) = line.split_once('\t') else { continue };
+        let values = values.split_whitespace().filter_map(|value| value.parse().ok()).collect();
+        samples.insert(id.to_string(), values);
+    }
+
+    Ok(samples)
+}
+
+fn median(values: &[f64]) -> f64 {
+    let mut sorted = values.to_vec();
+    sorted.sort_by(f64::total_cmp);
+
+    let middle = sorted.len() / 2;
+    if sorted.len() % 2 == 0 { (sorted[middle - 1] + sorted[middle]) / 2.0 } else { sorted[middle] }
+}
+
+fn format_duration(nanoseconds: f64) -> String {
+    match nanoseconds {
+        n if n >= 1e9 => format!("{:.3} s", n / 1e9),
+        n if n >= 1e6 => format!("{:.3} ms", n / 1e6),
+        n if n >= 1e3 => format!("{:.3} us", n / 1e3),
+        n => format!("{:.1} ns", n),
+    }
+}
+
+/// complementary error function, numerical recipes' chebyshev fit (fractional error below 1.2e-7)
+fn erfc(x: f64) -> f64 {
+    let z = x.abs();
+    let t = 1.0 / (1.0 + 0.5 * z);
+    let polynomial = -z * z - 1.26551223
+        + t * (1.00002368
+            + t * (0.37409196
+                + t * (0.09678418
+                    + t * (-0.18628806
+                        + t * (0.27886807
+                            + t * (-1.13520398 + t * (1.48851587 + t * (-0.82215223 + t * 0.17087277))))))));
+    let result = t * polynomial.exp();
+
+    if x >= 0.0 { result } else { 2.0 - result }
+}
+
+/// two sided p-value of the mann-whitney u test, normal approximation with tie and continuity correction. it makes
+/// no assumption about the shape of the distributions, which timings (long right tail) rarely fit anyway
+fn mann_whitney_p(first: &[f64], second: &[f64]) -> f64 {
+    let (n1, n2) = (first.len() as f64, second.len() as f64);
+    if first.is_empty() || second.is_empty() {
+        return 1.0;
+    }
+
+    let mut combined: Vec<(f64, bool)> =
+        first.iter().map(|&value| (value, true)).chain(second.iter().map(|&value| (value, false))).collect();
+    combined.sort_by(|a, b| a.0.total_cmp(&b.0));
+
+    // ties share the average of their ranks
+    let mut first_rank_sum = 0.0;
+    let mut tie_correction = 0.0;
+    let mut start = 0;
+    while start < combined.len() {
+        let mut end = start;
+        while end + 1 < combined.len() && combined[end + 1].0 == combined[start].0 {
+            end += 1;
+        }
+
+        let average_rank = (start + end) as f64 / 2.0 + 1.0;
+        let ties = (end - start + 1) as f64;
+        tie_correction += ties * ties * ties - ties;
+        first_rank_sum +=
+            average_rank * combined[start..=end].iter().filter(|(_, from_first)| *from_first).count() as f64;
+
+        start = end + 1;
+    }
+
+    let n = n1 + n2;
+    let u = first_rank_sum - n1 * (n1 + 1.0) / 2.0;
+    let mean = n1 * n2 / 2.0;
+    let variance = n1 * n2 / 12.0 * ((n + 1.0) - tie_correction / (n * (n - 1.0)));
+    if variance <= 0.0 {
+        return 1.0;
+    }
+
+    let z = ((u - mean).abs() - 0.5).max(0.0) / variance.sqrt();
+    erfc(z / std::f64::consts::SQRT_2).min(1.0)
+}
+
+fn print_samples(samples: &Samples) {
+    let width = samples.keys().map(|id| id.len()).max().unwrap_or(0);
+    for (id, values) in samples {
+        println!("{:<width$}  {:>12}  ({} samples)", id, format_duration(median(values)), values.len(), width = width);
+    }
+}
+
+/// prints a row per benchmark and returns how many of them regressed
+fn compare(baseline: &Samples, current: &Samples, options: &BenchOptions) -> usize {
+    let width = current.keys().map(|id| id.len()).max().unwrap_or(0);
+    println!(
+        "{:<width$}  {:>12}  {:>12}  {:>9}  {:>7}",
+        "benchmark",
+        "baseline",
+        "current",
+        "change",
+        "p",
+        width = width
+    );
+
+    let mut regressions = 0;
+    for (id, values) in current {
+        let Some(baseline_values) = baseline.get(id) else {
+            println!(
+                "{:<width$}  {:>12}  {:>12}  {}",
+                id,
+                "-",
+                format_duration(median(values)),
+                "new".dimmed(),
+                width = width
+            );
+            continue;
+        };
+
+        if values.len() < MINIMUM_SAMPLES || baseline_values.len() < MINIMUM_SAMPLES {
+            warn!("{} has too few samples for a meaningful comparison, raise --repetitions", id);
+        }
+
+        let (before, after) = (median(baseline_values), median(values));
+        let change = (after - before) / before * 100.0;
+        let p = mann_whitney_p(baseline_values, values);
+        let significant = p < options.alpha && change.abs() >= options.threshold;
+
+        let verdict = match significant {
+            true if change > 0.0 => {
+                regressions += 1;
+                "regressed".red().to_string()
+            }
+            true => "improved".green().to_string(),
+            false => "unchanged".dimmed().to_string(),
+        };
+
+        println!(
+            "{:<width$}  {:>12}  {:>12}  {:>+8.2}%  {:>7.4}  {}",
+            id,
+            format_duration(before),
+            format_duration(after),
+            change,
+            p,
+            verdict,
+            width = width
+        );
+    }
+
+    regressions
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn parses_benchmark_lines() {
+        let stdout = "warming up\nbench parse 12.5 us\nbench lookup 80 ns\nbench broken fast ns\nbench missing 3\nbench slow 1.5 s\n";
+        let results = parse_lines(stdout);
+        assert_eq!(
+            results,
+            [("parse".to_string(), 12_500.0), ("lookup".to_string(), 80.0), ("slow".to_string(), 1.5e9)]
+        );
+    }
+
+    #[test]
+    fn parses_google_benchmark_iterations() {
+        let report = r#"{"context": {}, "benchmarks": [
+            {"name": "BM_sort/64", "run_type": "iteration", "real_time": 2.5, "time_unit": "us"},
+            {"name": "BM_sort/64_mean", "run_type": "aggregate", "real_time": 2.5, "time_unit": "us"},
+            {"name": "BM_fails", "run_type": "iteration", "error_occurred": true, "real_time": 1.0},
+            {"name": "BM_copy", "run_type": "iteration", "real_time": 40.0}
+        ]}"#;
+
+        let results = parse_google_benchmark(report).unwrap();
+        assert_eq!(results, [("BM_sort/64".to_string(), 2500.0), ("BM_copy".to_string(), 40.0)]);
+        assert!(parse_google_benchmark("{}").is_err());
+    }
+
+    #[test]
+    fn mann_whitney_handles_tied_ranks() {
+        // ranks 1, 2.5 2.5, 5 5 against 5, 7.5 7.5, 9, 10, three tie groups
+        let p = mann_whitney_p(&[1.0, 2.0, 2.0, 3.0, 3.0], &[3.0, 4.0, 4.0, 5.0, 6.0]);
+        assert!((p - 0.019_243_6).abs() < 1e-5, "{}", p);
+
+        // nothing but ties has no variance, there is nothing to tell apart
+        assert_eq!(mann_whitney_p(&[7.0; 5], &[7.0; 5]), 1.0);
+    }
+
+    #[test]
+    fn mann_whitney_is_symmetric_for_separated_samples() {
+        let (low, high) = ([10.0, 11.0, 12.0, 13.0, 14.0, 15.0], [20.0, 21.0, 22.0, 23.0, 24.0, 25.0]);
+        let p = mann_whitney_p(&low, &high);
+        assert!((p - 0.005_074_9).abs() < 1e-5, "{}", p);
+        assert!((mann_whitney_p(&high, &low) - p).abs() < 1e-12);
+        assert_eq!(mann_whitney_p(&[], &high), 1.0);
+    }
+
+    #[test]
+    fn translates_filters_for_google_benchmark() {
+        assert_eq!(google_benchmark_filter("sorting", "sort"), None);
+        assert_eq!(google_benchmark_filter("sorting", "sorting/"), None);
+        assert_eq!(google_benchmark_filter("sorting", "BM_sort/64").as_deref(), Some("BM_sort/64"));
+        assert_eq!(google_benchmark_filter("sorting", "ing/BM.x").as_deref(), Some("ing/BM\\.x|^BM\\.x"));
+    }
+}
@@ -1,20 +1,291 @@
 use log::trace;
 use sha2::{Digest, Sha256};
 use std::fs;
-use std::path::Path;
+use std::path::{Path, PathBuf};
+use std::process::Command;
+use std::time::UNIX_EPOCH;
 
-use anyhow::Result;
+use anyhow::{Context, Result};
 
-pub fn hash_build_file(build_script: &Path) -> Result<String> {
-    trace!("computing hash for: {}", build_script.display());
-    let hash = hex::encode(Sha256::digest(fs::read(build_script)?));
+/// everything a compiled artifact was built from, the compiler that built it plus every file the compiler read
+/// (taken from its depfile), stored one input per line so a later run can tell whether a recompile is needed
+pub struct Fingerprint {
+    compiler:       String,
+    /// the binary `compiler` was read from, lets the next run reuse the version without executing it
+    compiler_stamp: Option<CompilerStamp>,
+    inputs:         Vec<InputFingerprint>,
+}
+
+/// where a compiler binary resolved to on PATH and when it was last written, an upgrade or a retargeted
+/// symlink moves one of the two
+#[derive(Clone, PartialEq)]
+pub struct CompilerStamp {
+    path:     PathBuf,
+    modified: u128,
+}
 
-    trace!("build script hash: {}", hash);
+struct InputFingerprint {
+    path:     PathBuf,
+    modified: u128,
+    size:     u64,
+    hash:     String,
+}
+
+pub fn hash_file(path: &Path) -> Result<String> {
+    trace!("computing hash for: {}", path.display());
+    let hash = hex::encode(Sha256::digest(fs::read(path)?));
+
+    trace!("file hash: {}", hash);
     Ok(hash)
 }
 
-pub fn update_build_cache(cache_file_path: &Path, hash: &str) -> Result<()> {
-    trace!("updating cache file: {}", cache_file_path.display());
-    fs::write(cache_file_path, hash)?;
-    Ok(())
+/// the first line of `<compiler> --version`, an updated compiler invalidates everything built by the old one
+pub fn compiler_version(compiler: &str) -> Result<String> {
+    let output =
+        Command::new(compiler).arg("--version").output().with_context(|| format!("failed to execute {}", compiler))?;
+
+    Ok(String::from_utf8_lossy(&output.stdout).lines().next().unwrap_or_default().trim().to_string())
+}
+
+/// reads the inputs of a make style depfile, `target: input input \` with backslash escaped spaces
+pub fn parse_depfile(text: &str) -> Vec<PathBuf> {
+    let text = text.replace("\\\r\n", " ").replace("\\\n", " ");
+    let inputs = match text.split_once(": ") {
+        Some((_, inputs)) => inputs,
+        None => return Vec::new(),
+    };
+
+    let mut paths = Vec::new();
+    let mut current = String::new();
+    let mut characters = inputs.chars().peekable();
+    while let Some(character) = characters.next() {
+        match character {
+            '\\' if characters.peek() == Some(&' ') => current.push(characters.next().unwrap()),
+            ' ' | '\t' | '\r' | '\n' => {
+                if !current.is_empty() {
+                    paths.push(PathBuf::from(std::mem::take(&mut current)));
+                }
+            }
+            _ => current.push(character),
+        }
+    }
+
+    if !current.is_empty() {
+        paths.push(PathBuf::from(current));
+    }
+
+    paths.sort();
+    paths.dedup();
+    paths
+}
+
+/// the executable `program` names, looked up on PATH unless it already is a path
+pub fn find_in_path(program: &str) -> Option<PathBuf> {
+    let candidate = Path::new(program);
+    if candidate.components().count() > 1 {
+        return candidate.is_file().then(|| candidate.to_path_buf());
+    }
+
+    let program =
+        if cfg!(windows) && candidate.extension().is_none() { format!("{}.exe", program) } else { program.to_string() };
+
+    std::env::split_paths(&std::env::var_os("PATH")?)
+        .map(|directory| directory.join(&program))
+        .find(|path| path.is_file())
+}
+
+impl CompilerStamp {
+    pub fn of(compiler: &str) -> Option<CompilerStamp> {
+        let path = fs::canonicalize(find_in_path(compiler)?).ok()?;
+        let modified = modified_time(&fs::metadata(&path).ok()?);
+        Some(CompilerStamp { path, modified })
+    }
+
+    fn parse(line: &str) -> Option<CompilerStamp> {
+        let (modified, path) = line.split_once('\t')?;
+        Some(CompilerStamp { path: PathBuf::from(path), modified: modified.parse().ok()? })
+    }
+
+    fn format(&self) -> String {
+        format!("{}\t{}", self.modified, self.path.display())
+    }
+}
+
+/// the first line of `<compiler> --version` as recorded in `record`, one `<version>\t<mtime>\t<path>` line per
+/// compiler binary. the compiler only runs when it is not in there yet or its binary was replaced since
+pub fn recorded_compiler_version(compiler: &str, record: &Path) -> Result<String> {
+    let Some(stamp) = CompilerStamp::of(compiler) else {
+        return compiler_version(compiler);
+    };
+
+    let text = fs::read_to_string(record).unwrap_or_default();
+    let entries: Vec<(&str, CompilerStamp)> = text
+        .lines()
+        .filter_map(|line| line.split_once('\t'))
+        .filter_map(|(version, stamp)| Some((version, CompilerStamp::parse(stamp)?)))
+        .collect();
+
+    if let Some((version, _)) = entries.iter().find(|(_, recorded)| *recorded == stamp) {
+        return Ok(version.to_string());
+    }
+
+    let version = compiler_version(compiler)?.replace('\t', " ");
+    let mut updated = format!("{}\t{}\n", version, stamp.format());
+    for (version, recorded) in entries.iter().filter(|(_, recorded)| recorded.path != stamp.path) {
+        updated += &format!("{}\t{}\n", version, recorded.format());
+    }
+
+    // parallel compiles race to update the record, each writes its own file and renames it into place
+    let temporary = record.with_extension(format!("{}.tmp", std::process::id()));
+    if let Err(err) = fs::write(&temporary, updated).and_then(|_| fs::rename(&temporary, record)) {
+        trace!("failed to update {}: {}", record.display(), err);
+        _ = fs::remove_file(&temporary);
+    }
+
+    Ok(version)
+}
+
+fn modified_time(metadata: &fs::Metadata) -> u128 {
+    metadata.modified().ok().and_then(|time| time.duration_since(UNIX_EPOCH).ok()).map_or(0, |time| time.as_nanos())
+}
+
+impl Fingerprint {
+    pub fn compute(compiler: String, inputs: &[PathBuf]) -> Result<Fingerprint> {
+        let mut fingerprints = Vec::with_capacity(inputs.len());
+        for path in inputs {
+            let metadata = fs::metadata(path).with_context(|| format!("failed to stat: {}", path.display()))?;
+            fingerprints.push(InputFingerprint {
+                path:     path.clone(),
+                modified: modified_time(&metadata),
+                size:     metadata.len(),
+                hash:     hash_file(path)?,
+            });
+        }
+
+        Ok(Fingerprint { compiler, compiler_stamp: None, inputs: fingerprints })
+    }
+
+    pub fn with_compiler_stamp(self, compiler_stamp: Option<CompilerStamp>) -> Fingerprint {
+        Fingerprint { compiler_stamp, ..self }
+    }
+
+    /// the recorded compiler version, as long as the compiler binary is still the one it was taken from
+    pub fn compiler_version(&self, stamp: &CompilerStamp) -> Option<&str> {
+        (self.compiler_stamp.as_ref() == Some(stamp)).then_some(self.compiler.as_str())
+    }
+
+    pub fn load(path: &Path) -> Option<Fingerprint> {
+        let text = fs::read_to_string(path).ok()?;
+        let mut lines = text.lines().peekable();
+
+        let compiler = lines.next()?.strip_prefix("compiler\t")?.to_string();
+        let compiler_stamp = lines
+            .next_if(|line| line.starts_with("compiler_binary\t"))
+            .and_then(|line| CompilerStamp::parse(line.strip_prefix("compiler_binary\t")?));
+
+        let mut inputs = Vec::new();
+        for line in lines {
+            let mut fields = line.splitn(4, '\t');
+            let hash = fields.next()?.to_string();
+            let modified = fields.next()?.parse().ok()?;
+            let size = fields.next()?.parse().ok()?;
+            let path = PathBuf::from(fields.next()?);
+            inputs.push(InputFingerprint { path, modified, size, hash });
+        }
+
+        Some(Fingerprint { compiler, compiler_stamp, inputs })
+    }
+
+    pub fn write(&self, path: &Path) -> Result<()> {
+        trace!("updating cache file: {}", path.display());
+
+        let mut text = format!("compiler\t{}\n", self.compiler);
+        if let Some(stamp) = &self.compiler_stamp {
+            text += &format!("compiler_binary\t{}\n", stamp.format());
+        }
+
+        for input in &self.inputs {
+            text += &format!("{}\t{}\t{}\t{}\n", input.hash, input.modified, input.size, input.path.display());
+        }
+
+        fs::write(path, text)?;
+        Ok(())
+    }
+
+    pub fn paths(&self) -> Vec<PathBuf> {
+        self.inputs.iter().map(|input| input.path.clone()).collect()
+    }
+
+    /// only inputs whose size or modification time moved get hashed, so checking a closure of a few hundred
+    /// system headers costs a round of stat calls rather than reading all of them
+    pub fn is_up_to_date(&self, compiler: &str) -> bool {
+        if self.compiler != compiler {
+            trace!("compiler changed from '{}' to '{}'", self.compiler, compiler);
+            return false;
+        }
+
+        self.inputs.iter().all(|input| {
+            let Ok(metadata) = fs::metadata(&input.path) else {
+                trace!("input went away: {}", input.path.display());
+                return false;
+            };
+
+            if metadata.len() == input.size && modified_time(&metadata) == input.modified {
+                return true;
+            }
+
+            let unchanged = hash_file(&input.path).is_ok_and(|hash| hash == input.hash);
+            if !unchanged {
+                trace!("input changed: {}", input.path.display());
+            }
+
+            unchanged
+        })
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn parses_escaped_depfile_inputs() {
+        let depfile = "build/main.o: src/main.cc \\\n  include/my\\ header.hpp src/main.cc\n";
+        assert_eq!(parse_depfile(depfile), [PathBuf::from("include/my header.hpp"), PathBuf::from("src/main.cc")]);
+        assert!(parse_depfile("no inputs").is_empty());
+    }
+
+    #[test]
+    fn reuses_the_compiler_version_only_for_the_same_binary() {
+        let file = std::env::temp_dir().join(format!("talon-fingerprint-{}.txt", std::process::id()));
+        let stamp = CompilerStamp { path: PathBuf::from("/usr/bin/clang++-18"), modified: 42 };
+        Fingerprint::compute("clang version 18".to_string(), &[])
+            .unwrap()
+            .with_compiler_stamp(Some(stamp.clone()))
+            .write(&file)
+            .unwrap();
+
+        let fingerprint = Fingerprint::load(&file).unwrap();
+        fs::remove_file(&file).unwrap();
+        assert_eq!(fingerprint.compiler_version(&stamp), Some("clang version 18"));
+        assert_eq!(fingerprint.compiler_version(&CompilerStamp { modified: 43, ..stamp.clone() }), None);
+        assert_eq!(
+            fingerprint.compiler_version(&CompilerStamp { path: PathBuf::from("/usr/bin/clang++-19"), ..stamp }),
+            None
+        );
+    }
+
+    #[test]
+    fn reads_recorded_versions_without_running_the_compiler() {
+        // running the test binary with --version would start the test suite again
+        let compiler = std::env::current_exe().unwrap();
+        let stamp = CompilerStamp::of(compiler.to_str().unwrap()).unwrap();
+        let record = std::env::temp_dir().join(format!("talon-compiler-versions-{}.txt", std::process::id()));
+        let other = CompilerStamp { path: PathBuf::from("/usr/bin/g++"), modified: 1 };
+        fs::write(&record, format!("gcc 14\t{}\nrecorded version\t{}\n", other.format(), stamp.format())).unwrap();
+
+        let version = recorded_compiler_version(compiler.to_str().unwrap(), &record);
+        fs::remove_file(&record).unwrap();
+        assert_eq!(version.unwrap(), "recorded version");
+    }
 }
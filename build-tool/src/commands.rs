@@ -1,9 +1,16 @@
-use crate::{cache, directory};
+use crate::bench::{self, BenchOptions};
+use crate::cache::{CompilerStamp, Fingerprint};
+use crate::pch::{self, PrecompiledHeader};
+use crate::test_runner::{self, TestOptions};
+use crate::{affected, cache, directory, profile};
 use anyhow::{Context, Result, bail};
 use log::{debug, trace, warn};
+use std::collections::HashMap;
+use std::io::{BufRead, BufReader, Write};
 use std::path::{Path, PathBuf};
-use std::process::Command;
-use std::{env, fs};
+use std::process::{Child, Command, Stdio};
+use std::time::{Duration, Instant, SystemTime};
+use std::{env, fs, thread};
 
 #[derive(Clone)]
 pub struct OutputPath(pub String);
@@ -61,7 +68,7 @@ pub fn run(
     args: Vec<String>,
     forward: Vec<String>,
 ) -> Result<()> {
-    let executable_path = build(backtrack, clean_first, path, args)?;
+    let executable_path = build(backtrack, clean_first, path, args, &[])?;
     trace!("running executable -> {:?}", &executable_path.0);
 
     _ = Command::new(executable_path.as_str()).args(forward).status()?;
@@ -69,19 +76,119 @@ pub fn run(
     Ok(())
 }
 
-pub fn build(backtrack: bool, clean_first: bool, path: Option<String>, args: Vec<String>) -> Result<OutputPath> {
+pub fn test(
+    backtrack: bool,
+    clean_first: bool,
+    path: Option<String>,
+    args: Vec<String>,
+    affected_inputs: &[String],
+    mut options: TestOptions,
+) -> Result<()> {
+    // after an affected build, only the tests whose executables got relinked are worth running
+    options.changed_only |= !affected_inputs.is_empty();
+
+    let builder_env = vec![("TALON_BUILD_TESTS", "1".to_string())];
+    build_with_env(backtrack, clean_first, path, args, affected_inputs, builder_env)?;
+
+    test_runner::run_tests(&options)
+}
+
+pub fn bench(
+    backtrack: bool,
+    clean_first: bool,
+    path: Option<String>,
+    args: Vec<String>,
+    options: BenchOptions,
+) -> Result<()> {
+    let builder_env = vec![("TALON_BUILD_BENCHMARKS", "1".to_string())];
+    build_with_env(backtrack, clean_first, path, args, &[], builder_env)?;
+
+    bench::run_benchmarks(&options)
+}
+
+pub fn profile(backtrack: bool, path: Option<String>, args: Vec<String>, forward: Vec<String>) -> Result<()> {
+    build(backtrack, false, path, args, &[])?;
+    profile::run_profile(&forward)
+}
+
+/// the builder does the analysis, it knows which objects went into the binary
+pub fn size(backtrack: bool, path: Option<String>, args: Vec<String>, top: usize) -> Result<()> {
+    let builder_env = vec![("TALON_SIZE_REPORT", top.to_string())];
+    build_with_env(backtrack, false, path, args, &[], builder_env)?;
+    Ok(())
+}
+
+pub fn build(
+    backtrack: bool,
+    clean_first: bool,
+    path: Option<String>,
+    args: Vec<String>,
+    affected_inputs: &[String],
+) -> Result<OutputPath> {
+    build_with_env(backtrack, clean_first, path, args, affected_inputs, Vec::new())
+}
+
+fn build_with_env(
+    backtrack: bool,
+    clean_first: bool,
+    path: Option<String>,
+    args: Vec<String>,
+    affected_inputs: &[String],
+    mut builder_env: Vec<(&'static str, String)>,
+) -> Result<OutputPath> {
     // FIXME we are calling resolve_working_directory twice if we receive a clean commad
     if clean_first && let Err(err) = clean(backtrack, path.clone()) {
         warn!("failed to clean directory before build: {:?}", err);
     }
 
+    let invocation_directory = env::current_dir()?;
     let working_directory = directory::resolve_working_directory(path, backtrack)?;
     env::set_current_dir(&working_directory)
         .with_context(|| format!("failed to change to directory: {}", working_directory.display()))?;
 
+    let (cache_build_file, output_path) = prepare_builder(&working_directory)?;
+
+    if !affected_inputs.is_empty() {
+        let changed_files =
+            affected::resolve_changed_files(affected_inputs, &invocation_directory, &working_directory)?;
+        if changed_files.is_empty() {
+            println!("no changed files, nothing to build");
+            return Ok(output_path);
+        }
+
+        debug!("changed files: {:?}", changed_files);
+        builder_env.push(("TALON_AFFECTED_FILES", changed_files.join("\n")));
+    }
+
+    let started = Instant::now();
+    execute_builder(&cache_build_file, args, &builder_env)?;
+    record_phase_time("execute_builder", started);
+
+    Ok(output_path)
+}
+
+/// appends `driver.<phase><tab>microseconds` to the file named by TALON_TIMINGS, next to the phases the builder
+/// writes there, read by the benchmark suite in benchmark/
+fn record_phase_time(phase: &str, started: Instant) {
+    let Some(path) = env::var_os("TALON_TIMINGS") else { return };
+
+    let line = format!("driver.{}\t{}\n", phase, started.elapsed().as_micros());
+    let written = fs::OpenOptions::new()
+        .create(true)
+        .append(true)
+        .open(&path)
+        .and_then(|mut file| file.write_all(line.as_bytes()));
+
+    if let Err(err) = written {
+        warn!("failed to record phase timing: {}", err);
+    }
+}
+
+/// compiles the builder if the build script changed, expects to be called from inside of the project
+fn prepare_builder(working_directory: &Path) -> Result<(PathBuf, OutputPath)> {
     let build_script_path = Path::new("build.cc");
     let cache_directory = Path::new(".talon");
-    let cache_hash_file = cache_directory.join("build_cache.txt");
+    let cache_fingerprint_file = cache_directory.join("build_cache.txt");
     let cache_build_file: PathBuf = {
         let mut buffer = cache_directory.join("talon_build");
         if cfg!(windows) {
@@ -101,21 +208,155 @@ pub fn build(backtrack: bool, clean_first: bool, path: Option<String>, args: Vec
     fs::create_dir_all(cache_directory)
         .with_context(|| format!("failed to create cache directory: {}", cache_directory.display()))?;
 
-    let current_hash = cache::hash_build_file(&build_script_path)
-        .with_context(|| format!("failed to hash build script: {}", build_script_path.display()))?;
-
-    if should_rebuild(&cache_hash_file, &current_hash)? {
-        compile_builder(&build_script_path, &cache_build_file)?;
-        update_cache(&cache_hash_file, &current_hash)?;
+    let started = Instant::now();
+    let fingerprint = Fingerprint::load(&cache_fingerprint_file);
+    let (compiler_version, compiler_stamp) = builder_compiler_version(fingerprint.as_ref())?;
+    let rebuild = should_rebuild(&cache_build_file, fingerprint.as_ref(), &compiler_version);
+    record_phase_time("cache_check", started);
+
+    if rebuild {
+        let started = Instant::now();
+        let inputs = compile_builder(&build_script_path, &cache_build_file, &compiler_version)?;
+        update_cache(&cache_fingerprint_file, compiler_version, compiler_stamp, &inputs)?;
+        record_phase_time("compile_builder", started);
         println!("build script compilation finished");
     } else {
+        // a compiler that was touched but reports the same version keeps the builder, remember its new stamp
+        if let (Some(fingerprint), Some(stamp)) = (fingerprint, compiler_stamp) {
+            if fingerprint.compiler_version(&stamp).is_none() {
+                fingerprint.with_compiler_stamp(Some(stamp)).write(&cache_fingerprint_file)?;
+            }
+        }
+
         println!("using cached builder (no changes detected)");
     }
 
-    execute_builder(&cache_build_file, args)?;
-
     let output_path = Path::new("build").join(&project_output_executable_name);
-    Ok(OutputPath(output_path.display().to_string()))
+    Ok((cache_build_file, OutputPath(output_path.display().to_string())))
+}
+
+/// printed by the builder after every successful build, see workspace::build
+const BUILD_SUCCESS_MARKER: &str = "[talon] build successful";
+/// a watching builder exits with this once build.cc changed, see detail::watch_restart_exit_code
+const BUILDER_RESTART_EXIT_CODE: i32 = 3;
+
+pub fn watch(
+    backtrack: bool,
+    path: Option<String>,
+    args: Vec<String>,
+    run_output: bool,
+    forward: Vec<String>,
+    mut test_options: Option<TestOptions>,
+) -> Result<()> {
+    let working_directory = directory::resolve_working_directory(path, backtrack)?;
+    env::set_current_dir(&working_directory)
+        .with_context(|| format!("failed to change to directory: {}", working_directory.display()))?;
+
+    let mut running_output: Option<Child> = None;
+    let mut linked_tests = HashMap::new();
+    loop {
+        let (cache_build_file, output_path) = match prepare_builder(&working_directory) {
+            Ok(prepared) => prepared,
+            Err(err) => {
+                eprintln!("{:?}", err);
+                println!("waiting for the build script to change");
+                wait_for_build_script_change()?;
+                continue;
+            }
+        };
+
+        // the builder stays resident and does the watching itself, we only follow its output
+        debug!("executing watching builder: {}", cache_build_file.display());
+        let mut command = Command::new(&cache_build_file);
+        command.args(&args).env("TALON_WATCH", "1").env("TALON_EXECUTABLE", std::env::current_exe()?);
+        if test_options.is_some() {
+            command.env("TALON_BUILD_TESTS", "1");
+            linked_tests = test_runner::test_executable_mtimes();
+        }
+
+        let mut builder = command
+            .stdout(Stdio::piped())
+            .spawn()
+            .with_context(|| format!("failed to execute builder: {}", cache_build_file.display()))?;
+
+        let stdout = builder.stdout.take().context("builder has no stdout")?;
+        for line in BufReader::new(stdout).lines() {
+            let line = line?;
+            println!("{}", line);
+
+            if run_output && line.starts_with(BUILD_SUCCESS_MARKER) {
+                restart_output(&mut running_output, &output_path, &forward)?;
+            }
+
+            if let Some(options) = &mut test_options {
+                if line.starts_with(BUILD_SUCCESS_MARKER) {
+                    run_relinked_tests(options, &mut linked_tests);
+                }
+            }
+        }
+
+        let status = builder.wait()?;
+        if status.code() == Some(BUILDER_RESTART_EXIT_CODE) {
+            trace!("build script changed, recompiling builder");
+            continue;
+        }
+
+        stop_output(&mut running_output);
+        bail!("builder stopped watching ({})", status);
+    }
+}
+
+/// runs the test executables linked since the previous build, `linked_tests` holds their modification times as of
+/// then. failures are reported and watching goes on
+fn run_relinked_tests(options: &mut TestOptions, linked_tests: &mut HashMap<PathBuf, SystemTime>) {
+    let current = test_runner::test_executable_mtimes();
+    let relinked: Vec<PathBuf> = current
+        .iter()
+        .filter(|(path, modified)| linked_tests.get(*path) != Some(*modified))
+        .map(|(path, _)| path.clone())
+        .collect();
+
+    *linked_tests = current;
+    if relinked.is_empty() {
+        trace!("no test executable was relinked");
+        return;
+    }
+
+    options.executables = Some(relinked);
+    if let Err(err) = test_runner::run_tests(options) {
+        eprintln!("{:?}", err);
+    }
+}
+
+fn restart_output(running_output: &mut Option<Child>, output_path: &OutputPath, forward: &[String]) -> Result<()> {
+    stop_output(running_output);
+
+    trace!("running executable -> {:?}", output_path.as_str());
+    let child = Command::new(output_path.as_str())
+        .args(forward)
+        .spawn()
+        .with_context(|| format!("failed to run {}", output_path.as_str()))?;
+
+    *running_output = Some(child);
+    Ok(())
+}
+
+fn stop_output(running_output: &mut Option<Child>) {
+    if let Some(mut child) = running_output.take() {
+        _ = child.kill();
+        _ = child.wait();
+    }
+}
+
+fn wait_for_build_script_change() -> Result<()> {
+    let modified = || fs::metadata("build.cc").and_then(|metadata| metadata.modified()).ok();
+
+    let initial = modified();
+    while modified() == initial {
+        thread::sleep(Duration::from_millis(250));
+    }
+
+    Ok(())
 }
 
 // FIXME not sure what to do, but now this folder runs full paths, as it has no use for relative
@@ -140,42 +381,94 @@ pub fn clean(backtrack: bool, path: Option<String>) -> Result<()> {
     Ok(())
 }
 
-fn should_rebuild(cache_hash_file: &Path, current_hash: &str) -> Result<bool> {
-    match std::fs::read_to_string(cache_hash_file) {
-        Ok(cached_hash) => Ok(cached_hash.trim() != current_hash),
-        Err(_) => {
+/// the builder is rebuilt when anything it was compiled from changed, build.cc, the talon headers, whatever else
+/// build.cc includes, or the compiler itself
+fn should_rebuild(cache_build_file: &Path, fingerprint: Option<&Fingerprint>, compiler_version: &str) -> bool {
+    if !cache_build_file.exists() {
+        debug!("no cached builder found, will rebuild");
+        return true;
+    }
+
+    match fingerprint {
+        Some(fingerprint) => !fingerprint.is_up_to_date(compiler_version),
+        None => {
             debug!("no cache file found, will rebuild");
-            Ok(true)
+            true
+        }
+    }
+}
+
+/// the builder compiler's version, taken from the last build's fingerprint while the binary on PATH is untouched so
+/// a no-op build does not have to execute the compiler
+fn builder_compiler_version(fingerprint: Option<&Fingerprint>) -> Result<(String, Option<CompilerStamp>)> {
+    if cfg!(windows) {
+        // cl has no --version, its banner goes to stderr on every invocation
+        return Ok(("msvc".to_string(), None));
+    }
+
+    let stamp = CompilerStamp::of(pch::BUILDER_COMPILER);
+    if let (Some(fingerprint), Some(stamp)) = (fingerprint, &stamp) {
+        if let Some(version) = fingerprint.compiler_version(stamp) {
+            trace!("reusing recorded compiler version: {}", version);
+            return Ok((version.to_string(), Some(stamp.clone())));
         }
     }
+
+    Ok((cache::compiler_version(pch::BUILDER_COMPILER)?, stamp))
 }
 
-fn compile_builder(build_script_path: &Path, output_path: &Path) -> Result<()> {
+/// compiles the builder and returns every file it was compiled from
+fn compile_builder(build_script_path: &Path, output_path: &Path, compiler_version: &str) -> Result<Vec<PathBuf>> {
     println!("compiling builder");
     trace!("build script: {}", build_script_path.display());
     trace!("output path: {}", output_path.display());
 
-    let output = if cfg!(windows) {
-        compile_with_msvc(build_script_path, output_path)?
-    } else {
-        compile_with_clang(build_script_path, output_path)?
-    };
+    if cfg!(windows) {
+        handle_compilation_output(compile_with_msvc(build_script_path, output_path)?)?;
+        return Ok(vec![build_script_path.to_path_buf()]);
+    }
+
+    let depfile = output_path.with_extension("d");
+    let precompiled_header = pch::find_or_create(compiler_version);
+
+    let mut output = compile_with_clang(build_script_path, output_path, &depfile, precompiled_header.as_ref())?;
+    if !output.status.success() && precompiled_header.is_some() {
+        // a pch clang refuses would otherwise break every build, retrying without it turns that into a slow compile
+        if String::from_utf8_lossy(&output.stderr).contains("precompiled header") {
+            warn!("precompiled header was rejected, compiling without it");
+            output = compile_with_clang(build_script_path, output_path, &depfile, None)?;
+        }
+    }
 
     handle_compilation_output(output)?;
-    Ok(())
-}
 
-fn compile_with_clang(build_script_path: &Path, output_path: &Path) -> Result<std::process::Output> {
-    let output_path_str = output_path.display().to_string();
-    let build_script_str = build_script_path.display().to_string();
+    let mut inputs = cache::parse_depfile(&fs::read_to_string(&depfile).context("compiler wrote no depfile")?);
+    if let Some(header) = precompiled_header {
+        inputs.extend(header.inputs);
+        inputs.push(header.path);
+    }
+
+    inputs.sort();
+    inputs.dedup();
+    Ok(inputs)
+}
 
-    let mut arguments = vec!["-g", "-O0", "-o", &output_path_str, &build_script_str, "-std=c++23"];
-    if cfg!(windows) {
-        arguments.extend(["-target", "x86_64-pc-windows-msvc"]);
+fn compile_with_clang(
+    build_script_path: &Path,
+    output_path: &Path,
+    depfile: &Path,
+    precompiled_header: Option<&PrecompiledHeader>,
+) -> Result<std::process::Output> {
+    let mut arguments: Vec<String> = pch::BUILDER_FLAGS.iter().map(|flag| flag.to_string()).collect();
+    arguments.extend(["-o".to_string(), output_path.display().to_string(), build_script_path.display().to_string()]);
+    arguments.extend(["-MD".to_string(), "-MF".to_string(), depfile.display().to_string()]);
+
+    if let Some(header) = precompiled_header {
+        arguments.extend(header.compile_flags());
     }
 
-    trace!("executing: clang++ {}", arguments.join(" "));
-    Command::new("clang++").args(&arguments).output().context("Failed to execute clang++")
+    trace!("executing: {} {}", pch::BUILDER_COMPILER, arguments.join(" "));
+    Command::new(pch::BUILDER_COMPILER).args(&arguments).output().context("Failed to execute clang++")
 }
 
 #[allow(unused)]
@@ -219,12 +512,19 @@ fn handle_compilation_output(output: std::process::Output) -> Result<()> {
     Ok(())
 }
 
-fn update_cache(cache_hash_file: &Path, current_hash: &str) -> Result<()> {
-    cache::update_build_cache(cache_hash_file, current_hash)
-        .with_context(|| format!("failed to update cache file: {}", cache_hash_file.display()))
+fn update_cache(
+    cache_fingerprint_file: &Path,
+    compiler_version: String,
+    compiler_stamp: Option<CompilerStamp>,
+    inputs: &[PathBuf],
+) -> Result<()> {
+    Fingerprint::compute(compiler_version, inputs)
+        .map(|fingerprint| fingerprint.with_compiler_stamp(compiler_stamp))
+        .and_then(|fingerprint| fingerprint.write(cache_fingerprint_file))
+        .with_context(|| format!("failed to update cache file: {}", cache_fingerprint_file.display()))
 }
 
-fn execute_builder(cache_build_file: &Path, args: Vec<String>) -> Result<()> {
+fn execute_builder(cache_build_file: &Path, args: Vec<String>, builder_env: &[(&str, String)]) -> Result<()> {
     debug!("executing builder: {}", cache_build_file.display());
 
     let mut cmd = Command::new(cache_build_file);
@@ -232,6 +532,14 @@ fn execute_builder(cache_build_file: &Path, args: Vec<String>) -> Result<()> {
         cmd.arg(arg);
     }
 
+    // distributed builds route their compile rule back through this executable
+    cmd.env("TALON_EXECUTABLE", std::env::current_exe()?);
+
+    for (key, value) in builder_env {
+        trace!("builder env: {}={}", key, value);
+        cmd.env(key, value);
+    }
+
     let status = cmd.status().with_context(|| format!("failed to execute builder: {}", cache_build_file.display()))?;
     if status.code() != Some(0) || !status.success() {
         return Err(anyhow::anyhow!("builder failed to compile"));
@@ -0,0 +1,673 @@
+use crate::cache;
+use anyhow::{Context, Result, bail};
+use log::{debug, info, trace, warn};
+use sha2::{Digest, Sha256};
+use std::collections::HashMap;
+use std::io::{self, Read, Write};
+use std::net::{TcpListener, TcpStream, ToSocketAddrs};
+use std::path::{Path, PathBuf};
+use std::process::{Command, Stdio};
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::sync::{Arc, Mutex};
+use std::time::Duration;
+use std::{env, fs, thread};
+
+/// objects keyed by compiler version, flags and preprocessed source, shared by remote and local compiles
+const OBJECT_CACHE: &str = ".talon/object_cache";
+/// guards against a misbehaving peer asking us to allocate absurd amounts of memory
+const MAX_FIELD_SIZE: u64 = 1 << 30;
+/// versions of the compilers the compile rule used, see cache::recorded_compiler_version
+const COMPILER_VERSIONS: &str = ".talon/compiler_versions.txt";
+const CONNECT_TIMEOUT: Duration = Duration::from_secs(2);
+/// how long a load query may take before the worker counts as unreachable
+const LOAD_TIMEOUT: Duration = Duration::from_secs(2);
+/// a worker that has not answered a compile job by then is given up on, the file is compiled locally instead
+const COMPILE_TIMEOUT: Duration = Duration::from_secs(120);
+
+pub trait Stream: Read + Write + Send {}
+impl<T: Read + Write + Send> Stream for T {}
+
+pub trait Listener: Send {
+    fn accept(&self) -> io::Result<Box<dyn Stream>>;
+}
+
+/// how the client reaches a worker, and how a worker listens for clients
+pub trait Transport: Send + Sync {
+    /// reads and writes on the returned stream fail with WouldBlock or TimedOut once they stall for `timeout`
+    fn connect(&self, timeout: Duration) -> io::Result<Box<dyn Stream>>;
+    fn listen(&self) -> io::Result<Box<dyn Listener>>;
+    fn describe(&self) -> String;
+}
+
+/// no authentication or encryption, anyone who can reach the port can submit jobs. bind workers to loopback or a
+/// trusted network only, the flag allow-list limits what a job can do but is no substitute for that
+struct TcpTransport {
+    address: String,
+}
+
+impl Transport for TcpTransport {
+    fn connect(&self, timeout: Duration) -> io::Result<Box<dyn Stream>> {
+        let mut last_error = io::Error::new(io::ErrorKind::NotFound, "address resolved to nothing");
+        for address in self.address.to_socket_addrs()? {
+            match TcpStream::connect_timeout(&address, CONNECT_TIMEOUT) {
+                Ok(stream) => {
+                    stream.set_nodelay(true)?;
+                    stream.set_read_timeout(Some(timeout))?;
+                    stream.set_write_timeout(Some(timeout))?;
+                    return Ok(Box::new(stream));
+                }
+                Err(err) => last_error = err,
+            }
+        }
+
+        Err(last_error)
+    }
+
+    fn listen(&self) -> io::Result<Box<dyn Listener>> {
+        Ok(Box::new(TcpListener::bind(&self.address)?))
+    }
+
+    fn describe(&self) -> String {
+        format!("tcp:{}", self.address)
+    }
+}
+
+impl Listener for TcpListener {
+    fn accept(&self) -> io::Result<Box<dyn Stream>> {
+        let (stream, _) = TcpListener::accept(self)?;
+        stream.set_nodelay(true)?;
+        stream.set_read_timeout(Some(COMPILE_TIMEOUT))?;
+        stream.set_write_timeout(Some(COMPILE_TIMEOUT))?;
+        Ok(Box::new(stream))
+    }
+}
+
+#[cfg(unix)]
+struct UnixTransport {
+    path: PathBuf,
+}
+
+#[cfg(unix)]
+impl Transport for UnixTransport {
+    fn connect(&self, timeout: Duration) -> io::Result<Box<dyn Stream>> {
+        let stream = std::os::unix::net::UnixStream::connect(&self.path)?;
+        stream.set_read_timeout(Some(timeout))?;
+        stream.set_write_timeout(Some(timeout))?;
+        Ok(Box::new(stream))
+    }
+
+    fn listen(&self) -> io::Result<Box<dyn Listener>> {
+        use std::os::unix::fs::FileTypeExt;
+
+        // a socket file left behind by a previous worker would make bind fail, anything else is not ours to delete
+        match fs::symlink_metadata(&self.path) {
+            Ok(metadata) if metadata.file_type().is_socket() => fs::remove_file(&self.path)?,
+            Ok(_) => {
+                return Err(io::Error::new(
+                    io::ErrorKind::AlreadyExists,
+                    format!("{} exists and is not a socket", self.path.display()),
+                ));
+            }
+            Err(_) => {}
+        }
+
+        Ok(Box::new(std::os::unix::net::UnixListener::bind(&self.path)?))
+    }
+
+    fn describe(&self) -> String {
+        format!("unix:{}", self.path.display())
+    }
+}
+
+#[cfg(unix)]
+impl Listener for std::os::unix::net::UnixListener {
+    fn accept(&self) -> io::Result<Box<dyn Stream>> {
+        let (stream, _) = std::os::unix::net::UnixListener::accept(self)?;
+        stream.set_read_timeout(Some(COMPILE_TIMEOUT))?;
+        stream.set_write_timeout(Some(COMPILE_TIMEOUT))?;
+        Ok(Box::new(stream))
+    }
+}
+
+/// `unix:/path/to/socket`, `tcp:host:port` or a bare `host:port`
+pub fn parse_endpoint(endpoint: &str) -> Result<Box<dyn Transport>> {
+    if let Some(path) = endpoint.strip_prefix("unix:") {
+        #[cfg(unix)]
+        return Ok(Box::new(UnixTransport { path: PathBuf::from(path) }));
+
+        #[cfg(not(unix))]
+        bail!("unix sockets are not supported on this platform: {}", path);
+    }
+
+    let address = endpoint.strip_prefix("tcp:").unwrap_or(endpoint);
+    if !address.contains(':') {
+        bail!("expected host:port, got '{}'", endpoint);
+    }
+
+    Ok(Box::new(TcpTransport { address: address.to_string() }))
+}
+
+// every message is a sequence of length prefixed fields
+
+fn write_field(stream: &mut dyn Write, bytes: &[u8]) -> io::Result<()> {
+    stream.write_all(&(bytes.len() as u64).to_le_bytes())?;
+    stream.write_all(bytes)
+}
+
+fn read_field(stream: &mut dyn Read) -> io::Result<Vec<u8>> {
+    let mut length = [0u8; 8];
+    stream.read_exact(&mut length)?;
+
+    let length = u64::from_le_bytes(length);
+    if length > MAX_FIELD_SIZE {
+        return Err(io::Error::new(io::ErrorKind::InvalidData, "field exceeds the maximum message size"));
+    }
+
+    let mut buffer = vec![0u8; length as usize];
+    stream.read_exact(&mut buffer)?;
+    Ok(buffer)
+}
+
+fn read_string(stream: &mut dyn Read) -> io::Result<String> {
+    String::from_utf8(read_field(stream)?).map_err(|err| io::Error::new(io::ErrorKind::InvalidData, err))
+}
+
+/// status ("ok", "failed" or "rejected"), compiler output and the object file
+fn write_response(stream: &mut dyn Write, status: &str, stderr: &[u8], object: &[u8]) -> io::Result<()> {
+    write_field(stream, status.as_bytes())?;
+    write_field(stream, stderr)?;
+    write_field(stream, object)
+}
+
+/// flags a worker passes on to the compiler. anything outside this list could run programs (-wrapper, -fplugin=, -B,
+/// -specs=) or read and write files (-o, @file) on the worker, so jobs carrying one are rejected
+fn is_allowed_compile_flag(flag: &str) -> bool {
+    const EXACT: &[&str] =
+        &["-w", "-pedantic", "-pedantic-errors", "-pthread", "-s", "-static", "-static-libgcc", "-static-libstdc++"];
+    if EXACT.contains(&flag) {
+        return true;
+    }
+
+    // a path would be resolved on the worker, relative names end up in the job directory the compiler runs in
+    if flag.contains('/') || flag.contains('\\') {
+        return false;
+    }
+
+    if let Some(option) = flag.strip_prefix("-f") {
+        return !option.starts_with("plugin") && !option.starts_with("pass-plugin");
+    }
+
+    if let Some(option) = flag.strip_prefix("-W") {
+        // forwarded to the assembler, preprocessor or linker
+        return !option.starts_with("a,") && !option.starts_with("p,") && !option.starts_with("l,");
+    }
+
+    if flag.starts_with("-m") {
+        return flag != "-mllvm";
+    }
+
+    // split debug info lands in a .dwo next to the object, which would be deleted along with the job directory
+    if flag.starts_with("-g") {
+        return !flag.starts_with("-gsplit-dwarf");
+    }
+
+    flag.starts_with("-O") || flag.starts_with("-std=")
+}
+
+struct WorkerState {
+    capacity:          usize,
+    active:            AtomicUsize,
+    allowed_compilers: Vec<String>,
+    compiler_versions: Mutex<HashMap<String, String>>,
+    next_job:          AtomicUsize,
+}
+
+/// serves compile requests until the process is killed, every connection gets its own thread
+pub fn run_worker(endpoint: &str, jobs: usize, allowed_compilers: Vec<String>) -> Result<()> {
+    let transport = parse_endpoint(endpoint)?;
+    let listener = transport.listen().with_context(|| format!("failed to listen on {}", transport.describe()))?;
+
+    let state = Arc::new(WorkerState {
+        capacity: jobs.max(1),
+        active: AtomicUsize::new(0),
+        allowed_compilers,
+        compiler_versions: Mutex::new(HashMap::new()),
+        next_job: AtomicUsize::new(0),
+    });
+
+    info!("worker listening on {} with {} job slot(s)", transport.describe(), state.capacity);
+
+    loop {
+        let stream = match listener.accept() {
+            Ok(stream) => stream,
+            Err(err) => {
+                warn!("failed to accept connection: {}", err);
+                continue;
+            }
+        };
+
+        let state = Arc::clone(&state);
+        thread::spawn(move || {
+            if let Err(err) = serve_connection(stream, &state) {
+                debug!("connection closed: {}", err);
+            }
+        });
+    }
+}
+
+fn serve_connection(mut stream: Box<dyn Stream>, state: &WorkerState) -> Result<()> {
+    let request = read_string(&mut stream)?;
+    match request.as_str() {
+        "load" => {
+            write_field(&mut stream, state.active.load(Ordering::Relaxed).to_string().as_bytes())?;
+            write_field(&mut stream, state.capacity.to_string().as_bytes())?;
+        }
+
+        "compile" => {
+            let compiler = read_string(&mut stream)?;
+            let client_version = read_string(&mut stream)?;
+            let flags = read_string(&mut stream)?;
+            let source = read_field(&mut stream)?;
+
+            let flags: Vec<String> = flags.split('\0').filter(|flag| !flag.is_empty()).map(str::to_string).collect();
+
+            // together with the flag allow-list this keeps clients from running arbitrary programs on this machine
+            if !state.allowed_compilers.contains(&compiler) {
+                let message = format!("compiler '{}' is not allowed on this worker", compiler);
+                write_response(&mut stream, "rejected", message.as_bytes(), &[])?;
+                return Ok(());
+            }
+
+            if let Some(flag) = flags.iter().find(|flag| !is_allowed_compile_flag(flag)) {
+                let message = format!("flag '{}' is not allowed on this worker", flag);
+                write_response(&mut stream, "rejected", message.as_bytes(), &[])?;
+                return Ok(());
+            }
+
+            let version = match worker_compiler_version(state, &compiler) {
+                Ok(version) => version,
+                Err(err) => {
+                    write_response(&mut stream, "rejected", format!("{:#}", err).as_bytes(), &[])?;
+                    return Ok(());
+                }
+            };
+
+            if version != client_version {
+                let message = format!("worker has a different {} version", compiler);
+                write_response(&mut stream, "rejected", message.as_bytes(), &[])?;
+                return Ok(());
+            }
+
+            state.active.fetch_add(1, Ordering::Relaxed);
+            let (status, stderr, object) = compile_preprocessed(state, &compiler, &flags, &source);
+            state.active.fetch_sub(1, Ordering::Relaxed);
+
+            write_response(&mut stream, status, &stderr, &object)?;
+        }
+
+        _ => bail!("unknown request: {}", request),
+    }
+
+    stream.flush()?;
+    Ok(())
+}
+
+fn worker_compiler_version(state: &WorkerState, compiler: &str) -> Result<String> {
+    let mut versions = state.compiler_versions.lock().unwrap();
+    if let Some(version) = versions.get(compiler) {
+        return Ok(version.clone());
+    }
+
+    let version = cache::compiler_version(compiler)?;
+    versions.insert(compiler.to_string(), version.clone());
+    Ok(version)
+}
+
+/// never fails, problems of the worker itself are reported as "rejected" so the client compiles somewhere else
+fn compile_preprocessed(
+    state: &WorkerState,
+    compiler: &str,
+    flags: &[String],
+    source: &[u8],
+) -> (&'static str, Vec<u8>, Vec<u8>) {
+    let job = state.next_job.fetch_add(1, Ordering::Relaxed);
+    let directory = env::temp_dir().join(format!("talon-worker-{}-{}", std::process::id(), job));
+
+    trace!("compiling job {} with {}", job, compiler);
+    let response = run_job(&directory, compiler, flags, source)
+        .unwrap_or_else(|err| ("rejected", format!("worker error: {:#}", err).into_bytes(), Vec::new()));
+
+    _ = fs::remove_dir_all(&directory);
+    response
+}
+
+fn run_job(
+    directory: &Path,
+    compiler: &str,
+    flags: &[String],
+    source: &[u8],
+) -> Result<(&'static str, Vec<u8>, Vec<u8>)> {
+    fs::create_dir_all(directory)?;
+
+    let input = directory.join("input.ii");
+    let output = directory.join("output.o");
+    fs::write(&input, source)?;
+
+    let result = Command::new(compiler)
+        .current_dir(directory)
+        .args(["-x", "c++-cpp-output"])
+        .args(flags)
+        .arg("-c")
+        .arg(&input)
+        .arg("-o")
+        .arg(&output)
+        .output()
+        .with_context(|| format!("failed to execute {}", compiler))?;
+
+    if !result.status.success() {
+        return Ok(("failed", result.stderr, Vec::new()));
+    }
+
+    let object = fs::read(&output).context("compiler produced no object")?;
+    Ok(("ok", result.stderr, object))
+}
+
+enum RemoteOutcome {
+    Compiled { object: Vec<u8>, stderr: Vec<u8> },
+    Failed { stderr: Vec<u8> },
+    Unavailable,
+}
+
+/// the compile rule of a distributed build, preprocesses locally (writing the depfile for ninja on the way),
+/// looks the result up in the object cache and otherwise ships it to the least loaded worker
+pub fn remote_compile(
+    workers: &[String],
+    input: &Path,
+    output: &Path,
+    depfile: &Path,
+    command: &[String],
+) -> Result<()> {
+    let (compiler, flags) = command.split_first().context("no compiler given")?;
+
+    let preprocessed = preprocess(compiler, flags, input, output, depfile)?;
+    let compile_flags = strip_preprocessor_flags(flags);
+    let version = cache::recorded_compiler_version(compiler, Path::new(COMPILER_VERSIONS))?;
+
+    let cache_key = {
+        let mut hasher = Sha256::new();
+        hasher.update(compiler.as_bytes());
+        hasher.update(version.as_bytes());
+        hasher.update(compile_flags.join("\0").as_bytes());
+        hasher.update(&preprocessed);
+        hex::encode(hasher.finalize())
+    };
+
+    let cached_object = Path::new(OBJECT_CACHE).join(format!("{}.o", cache_key));
+    if cached_object.exists() {
+        trace!("object cache hit for {}", input.display());
+        fs::copy(&cached_object, output)?;
+        return Ok(());
+    }
+
+    // workers would reject the job anyway, no need to ask every one of them
+    let outcome = if compile_flags.iter().all(|flag| is_allowed_compile_flag(flag)) {
+        compile_on_worker(workers, compiler, &version, &compile_flags, &preprocessed)
+    } else {
+        RemoteOutcome::Unavailable
+    };
+
+    match outcome {
+        RemoteOutcome::Compiled { object, stderr } => {
+            io::stderr().write_all(&stderr)?;
+            fs::write(output, &object)?;
+        }
+
+        RemoteOutcome::Failed { stderr } => {
+            io::stderr().write_all(&stderr)?;
+            bail!("failed to compile {}", input.display());
+        }
+
+        RemoteOutcome::Unavailable => {
+            debug!("no worker available for {}, compiling locally", input.display());
+            let status = Command::new(compiler).args(flags).arg("-c").arg(input).arg("-o").arg(output).status()?;
+            if !status.success() {
+                bail!("failed to compile {}", input.display());
+            }
+        }
+    }
+
+    store_in_cache(output, &cached_object);
+    Ok(())
+}
+
+fn preprocess(compiler: &str, flags: &[String], input: &Path, output: &Path, depfile: &Path) -> Result<Vec<u8>> {
+    let result = Command::new(compiler)
+        .args(flags)
+        .args(["-E", "-MD", "-MF"])
+        .arg(depfile)
+        .arg("-MT")
+        .arg(output)
+        .arg(input)
+        .stderr(Stdio::inherit())
+        .output()
+        .with_context(|| format!("failed to execute {}", compiler))?;
+
+    if !result.status.success() {
+        bail!("failed to preprocess {}", input.display());
+    }
+
+    Ok(result.stdout)
+}
+
+/// flags that only matter to the preprocessor, leaving them in would make the cache key depend on include paths
+fn strip_preprocessor_flags(flags: &[String]) -> Vec<String> {
+    let mut stripped = Vec::with_capacity(flags.len());
+    let mut skip_next = false;
+
+    for flag in flags {
+        if std::mem::take(&mut skip_next) {
+            continue;
+        }
+
+        if matches!(
+            flag.as_str(),
+            "-I" | "-isystem" | "-iquote" | "-idirafter" | "-D" | "-U" | "-include" | "-MF" | "-MT" | "-MQ"
+        ) {
+            skip_next = true;
+            continue;
+        }
+
+        let preprocessor_only = ["-I", "-isystem", "-iquote", "-idirafter", "-D", "-U", "-include", "-M"]
+            .iter()
+            .any(|prefix| flag.starts_with(prefix));
+        if !preprocessor_only {
+            stripped.push(flag.clone());
+        }
+    }
+
+    stripped
+}
+
+/// asks every worker for its load and sends the job to the one with the most free capacity
+fn compile_on_worker(
+    workers: &[String],
+    compiler: &str,
+    version: &str,
+    flags: &[String],
+    preprocessed: &[u8],
+) -> RemoteOutcome {
+    let mut candidates: Vec<(f64, Box<dyn Transport>)> = workers
+        .iter()
+        .filter_map(|worker| parse_endpoint(worker).map_err(|err| warn!("{:?}", err)).ok())
+        .filter_map(|transport| query_load(transport.as_ref()).map(|load| (load, transport)))
+        .collect();
+
+    candidates.sort_by(|a, b| a.0.total_cmp(&b.0));
+
+    for (load, transport) in candidates {
+        trace!("sending job to {} (load {:.2})", transport.describe(), load);
+        match send_compile(transport.as_ref(), compiler, version, flags, preprocessed) {
+            Ok(Some(outcome)) => return outcome,
+            Ok(None) => debug!("{} rejected the job", transport.describe()),
+            // the job may still be running there, handing it to the next worker could stall the build again
+            Err(err) if matches!(err.kind(), io::ErrorKind::WouldBlock | io::ErrorKind::TimedOut) => {
+                debug!("{} timed out", transport.describe());
+                return RemoteOutcome::Unavailable;
+            }
+            Err(err) => debug!("{} failed: {}", transport.describe(), err),
+        }
+    }
+
+    RemoteOutcome::Unavailable
+}
+
+fn query_load(transport: &dyn Transport) -> Option<f64> {
+    let query = || -> io::Result<f64> {
+        let mut stream = transport.connect(LOAD_TIMEOUT)?;
+        write_field(&mut stream, b"load")?;
+        stream.flush()?;
+
+        let active: f64 = read_string(&mut stream)?.parse().unwrap_or(f64::MAX);
+        let capacity: f64 = read_string(&mut stream)?.parse().unwrap_or(1.0);
+        Ok(active / capacity.max(1.0))
+    };
+
+    query().map_err(|err| trace!("{} unreachable: {}", transport.describe(), err)).ok()
+}
+
+fn send_compile(
+    transport: &dyn Transport,
+    compiler: &str,
+    version: &str,
+    flags: &[String],
+    preprocessed: &[u8],
+) -> io::Result<Option<RemoteOutcome>> {
+    let mut stream = transport.connect(COMPILE_TIMEOUT)?;
+    write_field(&mut stream, b"compile")?;
+    write_field(&mut stream, compiler.as_bytes())?;
+    write_field(&mut stream, version.as_bytes())?;
+    write_field(&mut stream, flags.join("\0").as_bytes())?;
+    write_field(&mut stream, preprocessed)?;
+    stream.flush()?;
+
+    let status = read_string(&mut stream)?;
+    let stderr = read_field(&mut stream)?;
+    let object = read_field(&mut stream)?;
+
+    Ok(match status.as_str() {
+        "ok" => Some(RemoteOutcome::Compiled { object, stderr }),
+        "failed" => Some(RemoteOutcome::Failed { stderr }),
+        _ => {
+            debug!("{}", String::from_utf8_lossy(&stderr));
+            None
+        }
+    })
+}
+
+/// the cache is an optimization, failing to fill it never fails the compile
+fn store_in_cache(object: &Path, cached_object: &Path) {
+    let store = || -> io::Result<()> {
+        fs::create_dir_all(OBJECT_CACHE)?;
+
+        // written under a temporary name first, a concurrent reader must never see a half written object
+        let temporary = cached_object.with_extension(format!("{}.tmp", std::process::id()));
+        fs::copy(object, &temporary)?;
+        fs::rename(&temporary, cached_object)
+    };
+
+    if let Err(err) = store() {
+        debug!("failed to store {} in the object cache: {}", object.display(), err);
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn strings(flags: &[&str]) -> Vec<String> {
+        flags.iter().map(|flag| flag.to_string()).collect()
+    }
+
+    #[test]
+    fn strips_preprocessor_flags_and_their_arguments() {
+        let flags = strings(&[
+            "-O2",
+            "-MD",
+            "-MF",
+            "build/a.o.d",
+            "-I",
+            "include",
+            "-isystem/usr/include",
+            "-DNDEBUG",
+            "-std=c++20",
+        ]);
+        assert_eq!(strip_preprocessor_flags(&flags), strings(&["-O2", "-std=c++20"]));
+    }
+
+    #[test]
+    fn keeps_flags_that_only_look_like_arguments() {
+        let flags = strings(&["-MT", "out.o", "-g", "-Wall"]);
+        assert_eq!(strip_preprocessor_flags(&flags), strings(&["-g", "-Wall"]));
+    }
+
+    #[test]
+    fn fields_round_trip() {
+        let mut buffer = Vec::new();
+        write_field(&mut buffer, b"compile").unwrap();
+        write_field(&mut buffer, &[]).unwrap();
+        write_field(&mut buffer, b"-O2\0-g").unwrap();
+
+        let mut reader = buffer.as_slice();
+        assert_eq!(read_string(&mut reader).unwrap(), "compile");
+        assert_eq!(read_field(&mut reader).unwrap(), b"");
+        assert_eq!(read_field(&mut reader).unwrap(), b"-O2\0-g");
+        assert!(read_field(&mut reader).is_err());
+    }
+
+    #[test]
+    fn rejects_oversized_fields() {
+        let length = (MAX_FIELD_SIZE + 1).to_le_bytes();
+        let error = read_field(&mut length.as_slice()).unwrap_err();
+        assert_eq!(error.kind(), io::ErrorKind::InvalidData);
+    }
+
+    #[test]
+    fn allows_code_generation_flags() {
+        for flag in [
+            "-O2",
+            "-std=c++20",
+            "-Wall",
+            "-Werror",
+            "-g",
+            "-fPIC",
+            "-fsanitize=address,undefined",
+            "-march=native",
+            "-static",
+        ] {
+            assert!(is_allowed_compile_flag(flag), "{}", flag);
+        }
+    }
+
+    #[test]
+    fn rejects_flags_that_run_programs_or_touch_files() {
+        for flag in [
+            "-wrapper,/bin/sh,-c,id",
+            "-fplugin=evil.so",
+            "-fplugin-arg-evil-x=1",
+            "-fpass-plugin=evil.so",
+            "-B/tmp/evil",
+            "-specs=evil.specs",
+            "-o",
+            "@flags.txt",
+            "-Wl,-T,script",
+            "-Wa,-adhln=listing",
+            "-Wp,-MD,deps",
+            "-mllvm",
+            "-fprofile-use=/etc/shadow",
+            "-save-temps",
+            "-gsplit-dwarf",
+        ] {
+            assert!(!is_allowed_compile_flag(flag), "{}", flag);
+        }
+    }
+}
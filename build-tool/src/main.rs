@@ -1,9 +1,17 @@
+mod affected;
+mod bench;
 mod cache;
 mod commands;
 mod directory;
+mod distributed;
+mod pch;
+mod profile;
+mod test_runner;
 
 use anyhow::Result;
 use clap::{Parser, Subcommand};
+use std::path::PathBuf;
+use std::time::Duration;
 
 #[derive(Parser)]
 #[command(name = "talon")]
@@ -64,8 +72,207 @@ enum Commands {
         /// Gets sent as an argument to builder, used to set the build profile
         #[arg(short, long = "profile")]
         profile_args: Vec<String>,
+
+        /// Only compiles what the given changed files (or the diff against a git ref, untracked files included) can
+        /// reach, the output is not relinked
+        #[arg(long, num_args = 1.., value_name = "FILES|GIT_REF")]
+        affected: Vec<String>,
+    },
+
+    /// Keeps the builder resident and rebuilds the assumed (or specified) project whenever a source changes
+    Watch {
+        /// Searches backwards for a talon build script
+        #[arg(short, long)]
+        backtrack: bool,
+
+        /// Path to the talon project
+        path: Option<String>,
+
+        /// Gets sent as an argument to builder, used to set the build profile
+        #[arg(short, long = "profile")]
+        profile_args: Vec<String>,
+
+        /// Restarts the output executable after every successful build
+        #[arg(short, long)]
+        run: bool,
+
+        /// Builds the test targets too and runs the ones every successful build relinked
+        #[arg(long)]
+        test: bool,
+
+        /// Gets sent to the output executable
+        #[arg(last = true)]
+        output_args: Vec<String>,
+    },
+
+    /// Builds and runs the test targets of the assumed (or specified) project
+    Test {
+        /// Searches backwards for a talon build script
+        #[arg(short, long)]
+        backtrack: bool,
+
+        /// Clean builds the project
+        #[arg(short, long)]
+        clean: bool,
+
+        /// Path to the talon project
+        path: Option<String>,
+
+        /// Gets sent as an argument to builder, used to set the build profile
+        #[arg(short, long = "profile")]
+        profile_args: Vec<String>,
+
+        /// Number of tests to run in parallel, defaults to the number of cores
+        #[arg(short, long)]
+        jobs: Option<usize>,
+
+        /// Only runs one shard of the tests, written as INDEX/COUNT (e.g. 1/4)
+        #[arg(long, value_parser = test_runner::parse_shard)]
+        shard: Option<(usize, usize)>,
+
+        /// Kills and fails any single test running longer than this many seconds
+        #[arg(long, value_name = "SECONDS")]
+        timeout: Option<u64>,
+
+        /// Only runs tests whose name contains this string
+        #[arg(long)]
+        filter: Option<String>,
+
+        /// Only runs tests whose executable changed since they last passed
+        #[arg(long)]
+        changed: bool,
+
+        /// Where the JUnit XML report is written
+        #[arg(long, default_value = "build/test-results.xml")]
+        junit: PathBuf,
+
+        /// Only builds and runs the tests the given changed files (or the diff against a git ref, untracked files
+        /// included) can reach
+        #[arg(long, num_args = 1.., value_name = "FILES|GIT_REF")]
+        affected: Vec<String>,
+    },
+
+    /// Builds the benchmark targets with optimizations, runs them and compares the results against a baseline
+    Bench {
+        /// Searches backwards for a talon build script
+        #[arg(short, long)]
+        backtrack: bool,
+
+        /// Clean builds the project
+        #[arg(short, long)]
+        clean: bool,
+
+        /// Path to the talon project
+        path: Option<String>,
+
+        /// Gets sent as an argument to builder, used to set the build profile
+        #[arg(short, long = "profile")]
+        profile_args: Vec<String>,
+
+        /// How often every benchmark executable is run, each run adds one sample per benchmark
+        #[arg(short, long, default_value_t = 10)]
+        repetitions: usize,
+
+        /// Core the benchmarks are pinned to, defaults to the last one available
+        #[arg(long)]
+        cpu: Option<usize>,
+
+        /// Runs the benchmarks wherever the scheduler puts them
+        #[arg(long)]
+        no_pin: bool,
+
+        /// Only keeps benchmarks whose name contains this string
+        #[arg(long)]
+        filter: Option<String>,
+
+        /// Revision (or stored result name) to compare against, exits with an error when a benchmark regressed
+        #[arg(long, value_name = "GIT_REF")]
+        baseline: Option<String>,
+
+        /// Largest p-value of the Mann-Whitney U test still counted as a real change
+        #[arg(long, default_value_t = 0.05)]
+        alpha: f64,
+
+        /// Median changes below this many percent are never reported as regressions
+        #[arg(long, value_name = "PERCENT", default_value_t = 2.0)]
+        threshold: f64,
     },
 
+    /// Builds the project and breaks the binary size down by section, translation unit, namespace and template
+    Size {
+        /// Searches backwards for a talon build script
+        #[arg(short, long)]
+        backtrack: bool,
+
+        /// Path to the talon project
+        path: Option<String>,
+
+        /// Gets sent as an argument to builder, used to set the build profile
+        #[arg(short, long = "profile")]
+        profile_args: Vec<String>,
+
+        /// Number of rows shown per table
+        #[arg(long, default_value_t = 15)]
+        top: usize,
+    },
+
+    /// Builds the instrumented project, runs it and converts the trace into a chrome trace and folded stacks
+    Profile {
+        /// Searches backwards for a talon build script
+        #[arg(short, long)]
+        backtrack: bool,
+
+        /// Path to the talon project
+        path: Option<String>,
+
+        /// Gets sent as an argument to builder, used to set the build profile
+        #[arg(short, long = "profile")]
+        profile_args: Vec<String>,
+
+        /// Gets sent to the output executable
+        #[arg(last = true)]
+        output_args: Vec<String>,
+    },
+
+    /// Serves compile jobs of distributed builds from other machines (or processes)
+    Worker {
+        /// Where to listen, either unix:/path/to/socket or tcp:host:port. tcp has no authentication, only bind it
+        /// to loopback or a trusted network
+        #[arg(long)]
+        listen: String,
+
+        /// Number of compile jobs advertised to clients, defaults to the number of cores
+        #[arg(short, long)]
+        jobs: Option<usize>,
+
+        /// Compilers clients are allowed to run on this worker
+        #[arg(long = "allow-compiler", default_values = ["g++", "clang++", "c++"])]
+        allowed_compilers: Vec<String>,
+    },
+
+    /// Compile rule of distributed builds, invoked by ninja
+    #[command(hide = true)]
+    RemoteCompile {
+        #[arg(long, value_delimiter = ',')]
+        workers: Vec<String>,
+
+        #[arg(long)]
+        input: PathBuf,
+
+        #[arg(long)]
+        output: PathBuf,
+
+        #[arg(long)]
+        depfile: PathBuf,
+
+        /// The compiler followed by its flags
+        #[arg(last = true, required = true)]
+        command: Vec<String>,
+    },
+
+    /// Precompiles the talon headers, which makes compiling build scripts a lot faster (done by the installer)
+    Precompile,
+
     /// Cleans the assumed (or specified) project by removing the build and cache
     Clean {
         /// Searches backwards for a talon build script
@@ -101,9 +308,91 @@ fn main() -> Result<()> {
     match cli.command {
         Commands::New { name } => commands::new(name)?,
         Commands::Clean { backtrack, path } => commands::clean(backtrack, path)?,
+        Commands::Precompile => pch::precompile_command()?,
+
+        Commands::Build { backtrack, clean, path, profile_args, affected } => {
+            _ = commands::build(backtrack, clean, path, profile_args, &affected)?
+        }
+
+        Commands::Bench {
+            backtrack,
+            clean,
+            path,
+            profile_args,
+            repetitions,
+            cpu,
+            no_pin,
+            filter,
+            baseline,
+            alpha,
+            threshold,
+        } => {
+            let options = bench::BenchOptions {
+                repetitions: repetitions.max(1),
+                cpu,
+                pin: !no_pin,
+                filter,
+                baseline,
+                alpha,
+                threshold,
+            };
+
+            commands::bench(backtrack, clean, path, profile_args, options)?
+        }
+
+        Commands::Size { backtrack, path, profile_args, top } => commands::size(backtrack, path, profile_args, top)?,
+
+        Commands::Profile { backtrack, path, profile_args, output_args } => {
+            commands::profile(backtrack, path, profile_args, output_args)?
+        }
+
+        Commands::Worker { listen, jobs, allowed_compilers } => {
+            let jobs = jobs.unwrap_or_else(|| std::thread::available_parallelism().map_or(1, |n| n.get()));
+            distributed::run_worker(&listen, jobs, allowed_compilers)?
+        }
+
+        Commands::RemoteCompile { workers, input, output, depfile, command } => {
+            distributed::remote_compile(&workers, &input, &output, &depfile, &command)?
+        }
+
+        Commands::Watch { backtrack, path, profile_args, run, test, output_args } => {
+            let test_options = test.then(|| test_runner::TestOptions {
+                jobs:         std::thread::available_parallelism().map_or(1, |n| n.get()),
+                shard:        None,
+                timeout:      None,
+                filter:       None,
+                changed_only: false,
+                junit_path:   PathBuf::from("build/test-results.xml"),
+                executables:  None,
+            });
+
+            commands::watch(backtrack, path, profile_args, run, output_args, test_options)?
+        }
+
+        Commands::Test {
+            backtrack,
+            clean,
+            path,
+            profile_args,
+            jobs,
+            shard,
+            timeout,
+            filter,
+            changed,
+            junit,
+            affected,
+        } => {
+            let options = test_runner::TestOptions {
+                jobs: jobs.unwrap_or_else(|| std::thread::available_parallelism().map_or(1, |n| n.get())),
+                shard,
+                timeout: timeout.map(Duration::from_secs),
+                filter,
+                changed_only: changed,
+                junit_path: junit,
+                executables: None,
+            };
 
-        Commands::Build { backtrack, clean, path, profile_args } => {
-            _ = commands::build(backtrack, clean, path, profile_args)?
+            commands::test(backtrack, clean, path, profile_args, &affected, options)?
         }
 
         Commands::Run { backtrack, clean, path, profile_args, output_args } => {
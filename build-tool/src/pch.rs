@@ -0,0 +1,101 @@
+use crate::cache::{self, Fingerprint};
+use anyhow::{Context, Result, bail};
+use log::{debug, trace};
+use std::fs;
+use std::path::PathBuf;
+use std::process::Command;
+
+/// flags every build script is compiled with, clang only accepts a precompiled header built with the same ones
+pub const BUILDER_FLAGS: &[&str] = &["-g", "-O0", "-std=c++23"];
+pub const BUILDER_COMPILER: &str = "clang++";
+
+/// the talon headers (and the standard headers they pull in) precompiled once per user, see `talon precompile`
+pub struct PrecompiledHeader {
+    pub path:   PathBuf,
+    pub inputs: Vec<PathBuf>,
+}
+
+impl PrecompiledHeader {
+    /// a touched but otherwise unchanged header would otherwise make clang reject the pch, our own fingerprint
+    /// already compares contents the same way
+    pub fn compile_flags(&self) -> Vec<String> {
+        vec![
+            "-include-pch".to_string(),
+            self.path.display().to_string(),
+            "-Xclang".to_string(),
+            "-fpch-validate-input-files-content".to_string(),
+        ]
+    }
+}
+
+fn pch_directory() -> Result<PathBuf> {
+    let cache = dirs::cache_dir().context("could not find the user cache directory")?;
+    Ok(cache.join("talon").join("pch"))
+}
+
+/// returns the precompiled header when it is still valid for the given compiler, recompiling it when it went
+/// stale, every failure just means build scripts get compiled without it
+pub fn find_or_create(compiler_version: &str) -> Option<PrecompiledHeader> {
+    let directory = pch_directory().ok()?;
+    let pch_path = directory.join("talon.pch");
+
+    if let Some(fingerprint) = Fingerprint::load(&directory.join("talon.pch.txt")) {
+        if pch_path.exists() && fingerprint.is_up_to_date(compiler_version) {
+            trace!("using precompiled header: {}", pch_path.display());
+            let inputs = fingerprint.paths();
+            return Some(PrecompiledHeader { path: pch_path, inputs });
+        }
+    }
+
+    debug!("precompiled header is missing or stale, recompiling it");
+    match precompile(compiler_version) {
+        Ok(header) => Some(header),
+        Err(error) => {
+            debug!("failed to precompile the talon headers, continuing without: {:#}", error);
+            None
+        }
+    }
+}
+
+pub fn precompile(compiler_version: &str) -> Result<PrecompiledHeader> {
+    let directory = pch_directory()?;
+    fs::create_dir_all(&directory).with_context(|| format!("failed to create directory: {}", directory.display()))?;
+
+    let header = directory.join("talon_pch.hpp");
+    fs::write(&header, "#include <talon/talon.hpp>\n")?;
+
+    // several talon invocations might race to create it, each compiles into its own file and the last rename wins
+    let pch_path = directory.join("talon.pch");
+    let temporary_pch = directory.join(format!("talon.pch.{}.tmp", std::process::id()));
+    let depfile = directory.join(format!("talon.pch.{}.d", std::process::id()));
+
+    let mut command = Command::new(BUILDER_COMPILER);
+    command.args(BUILDER_FLAGS).args(["-x", "c++-header"]).arg(&header).arg("-o").arg(&temporary_pch);
+    command.arg("-MD").arg("-MF").arg(&depfile);
+
+    trace!("executing: {:?}", command);
+    let output = command.output().with_context(|| format!("failed to execute {}", BUILDER_COMPILER))?;
+    if !output.status.success() {
+        _ = fs::remove_file(&temporary_pch);
+        _ = fs::remove_file(&depfile);
+        bail!("{}", String::from_utf8_lossy(&output.stderr).trim());
+    }
+
+    let inputs = cache::parse_depfile(&fs::read_to_string(&depfile)?);
+    _ = fs::remove_file(&depfile);
+
+    fs::rename(&temporary_pch, &pch_path)?;
+    Fingerprint::compute(compiler_version.to_string(), &inputs)?.write(&directory.join("talon.pch.txt"))?;
+
+    debug!("precompiled the talon headers into {}", pch_path.display());
+    Ok(PrecompiledHeader { path: pch_path, inputs })
+}
+
+/// `talon precompile`, run by the installer so the first build script compile already benefits
+pub fn precompile_command() -> Result<()> {
+    let compiler_version = cache::compiler_version(BUILDER_COMPILER)?;
+    let header = precompile(&compiler_version).context("failed to precompile the talon headers")?;
+
+    println!("precompiled talon headers: {}", header.path.display());
+    Ok(())
+}
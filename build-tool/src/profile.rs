@@ -0,0 +1,412 @@
+use anyhow::{Context, Result, bail};
+use log::{debug, trace, warn};
+use std::collections::{BTreeMap, HashMap};
+use std::fs::{self, File};
+use std::io::{BufWriter, Write};
+use std::path::{Path, PathBuf};
+use std::process::{Command, Stdio};
+use std::time::SystemTime;
+
+/// written by the builder next to the manifest, see workspace::write_instrumentation_files
+const INSTRUMENTATION_FILE: &str = ".talon/instrumentation.txt";
+const PROFILE_DIRECTORY: &str = "build/profile";
+
+/// layout is documented in details/function_trace.hpp
+const FUNCTION_TRACE_MAGIC: &[u8; 8] = b"TALONFT1";
+const FUNCTION_TRACE_RECORD_SIZE: usize = 24;
+
+enum Instrumentation {
+    Xray,
+    Functions,
+}
+
+struct TraceRecord {
+    nanoseconds: u64,
+    function:    u64,
+    thread:      u32,
+    exit:        bool,
+}
+
+/// runs the freshly built binary with tracing enabled and leaves a chrome trace (chrome://tracing, perfetto) and
+/// folded stacks (flamegraph.pl, speedscope) in build/profile
+pub fn run_profile(arguments: &[String]) -> Result<()> {
+    let (instrumentation, binary) = read_instrumentation()?;
+    fs::create_dir_all(PROFILE_DIRECTORY)?;
+
+    let trace_path = Path::new(PROFILE_DIRECTORY).join("trace.json");
+    let stacks_path = Path::new(PROFILE_DIRECTORY).join("stacks.folded");
+
+    match instrumentation {
+        Instrumentation::Xray => profile_xray(&binary, arguments, &trace_path, &stacks_path)?,
+        Instrumentation::Functions => profile_functions(&binary, arguments, &trace_path, &stacks_path)?,
+    }
+
+    println!("chrome trace: {}", trace_path.display());
+    println!("folded stacks: {}", stacks_path.display());
+    Ok(())
+}
+
+fn read_instrumentation() -> Result<(Instrumentation, PathBuf)> {
+    let text = fs::read_to_string(INSTRUMENTATION_FILE).context("the builder did not report its instrumentation")?;
+    let mut lines = text.lines();
+
+    let instrumentation = match lines.next() {
+        Some("xray") => Instrumentation::Xray,
+        Some("functions") => Instrumentation::Functions,
+        _ => bail!("the project is not instrumented, set build_options::instrumentation in build.cc"),
+    };
+
+    let binary = PathBuf::from(lines.next().context("instrumentation file has no output")?);
+    Ok((instrumentation, binary))
+}
+
+fn run_binary(binary: &Path, arguments: &[String], environment: &[(&str, String)]) -> Result<()> {
+    debug!("profiling: {} {:?}", binary.display(), arguments);
+
+    let mut command = Command::new(binary);
+    command.args(arguments);
+    for (key, value) in environment {
+        trace!("profile env: {}={}", key, value);
+        command.env(key, value);
+    }
+
+    let status = command.status().with_context(|| format!("failed to execute: {}", binary.display()))?;
+    if !status.success() {
+        warn!("{} exited with {}, the trace might be incomplete", binary.display(), status);
+    }
+
+    Ok(())
+}
+
+fn profile_xray(binary: &Path, arguments: &[String], trace_path: &Path, stacks_path: &Path) -> Result<()> {
+    let log_base = format!("{}/xray-log.", PROFILE_DIRECTORY);
+    let started = SystemTime::now();
+
+    let options = format!("patch_premain=true xray_mode=xray-basic xray_logfile_base={}", log_base);
+    run_binary(binary, arguments, &[("XRAY_OPTIONS", options)])?;
+
+    // the runtime appends the program name and a random suffix, take the log this run wrote
+    let log = fs::read_dir(PROFILE_DIRECTORY)?
+        .filter_map(|entry| entry.ok())
+        .filter(|entry| entry.file_name().to_string_lossy().starts_with("xray-log."))
+        .filter_map(|entry| Some((entry.metadata().ok()?.modified().ok()?, entry.path())))
+        .filter(|(modified, _)| *modified >= started)
+        .max_by_key(|(modified, _)| *modified)
+        .map(|(_, path)| path)
+        .context("the program wrote no xray log, was it built with instrumentation_mode::xray?")?;
+
+    let instrumentation_map = format!("--instr_map={}", binary.display());
+    let convert = Command::new("llvm-xray")
+        .args(["convert", "--symbolize", &instrumentation_map, "--output-format=trace_event", "-o"])
+        .arg(trace_path)
+        .arg(&log)
+        .status()
+        .context("failed to execute llvm-xray")?;
+    if !convert.success() {
+        bail!("llvm-xray failed to convert {}", log.display());
+    }
+
+    let stacks = Command::new("llvm-xray")
+        .args(["stack", &instrumentation_map, "--all-stacks", "--stack-format=flame", "--aggregation-type=time"])
+        .arg(&log)
+        .stdout(File::create(stacks_path)?)
+        .status()
+        .context("failed to execute llvm-xray")?;
+    if !stacks.success() {
+        bail!("llvm-xray failed to collect the stacks of {}", log.display());
+    }
+
+    Ok(())
+}
+
+fn profile_functions(binary: &Path, arguments: &[String], trace_path: &Path, stacks_path: &Path) -> Result<()> {
+    let raw_trace = Path::new(PROFILE_DIRECTORY).join("function-trace.bin");
+    _ = fs::remove_file(&raw_trace);
+
+    run_binary(binary, arguments, &[("TALON_TRACE_FILE", raw_trace.display().to_string())])?;
+
+    let data = fs::read(&raw_trace)
+        .context("the program wrote no trace, was it built with instrumentation_mode::functions?")?;
+    let (load_address, records) = parse_function_trace(&data)?;
+    debug!("read {} trace records", records.len());
+
+    let names = symbolize(binary, load_address, &records)?;
+    write_chrome_trace(trace_path, &records, &names)?;
+    write_folded_stacks(stacks_path, &records, &names)?;
+    Ok(())
+}
+
+fn parse_function_trace(data: &[u8]) -> Result<(u64, Vec<TraceRecord>)> {
+    if data.len() < 16 || &data[..8] != FUNCTION_TRACE_MAGIC {
+        bail!("not a talon function trace");
+    }
+
+    let u64_at = |bytes: &[u8], offset: usize| u64::from_le_bytes(bytes[offset..offset + 8].try_into().unwrap());
+    let u32_at = |bytes: &[u8], offset: usize| u32::from_le_bytes(bytes[offset..offset + 4].try_into().unwrap());
+
+    let load_address = u64_at(data, 8);
+    let records = data[16..]
+        .chunks_exact(FUNCTION_TRACE_RECORD_SIZE)
+        .map(|record| TraceRecord {
+            nanoseconds: u64_at(record, 0),
+            function:    u64_at(record, 8),
+            thread:      u32_at(record, 16),
+            exit:        u32_at(record, 20) != 0,
+        })
+        .collect();
+
+    Ok((load_address, records))
+}
+
+/// resolves the traced addresses through addr2line in one batch, addresses outside of the executable (shared
+/// libraries) stay hexadecimal
+fn symbolize(binary: &Path, load_address: u64, records: &[TraceRecord]) -> Result<HashMap<u64, String>> {
+    let mut addresses: Vec<u64> = records.iter().map(|record| record.function).collect();
+    addresses.sort_unstable();
+    addresses.dedup();
+
+    let mut child = Command::new("addr2line")
+        .args(["-f", "-C", "-e"])
+        .arg(binary)
+        .stdin(Stdio::piped())
+        .stdout(Stdio::piped())
+        .spawn()
+        .context("failed to execute addr2line")?;
+
+    // fed from a separate thread, addr2line answers while it reads and would fill the stdout pipe otherwise
+    let mut stdin = child.stdin.take().context("addr2line has no stdin")?;
+    let queries: Vec<String> =
+        addresses.iter().map(|address| format!("{:#x}\n", address.wrapping_sub(load_address))).collect();
+    let writer = std::thread::spawn(move || -> std::io::Result<()> {
+        for query in queries {
+            stdin.write_all(query.as_bytes())?;
+        }
+        Ok(())
+    });
+
+    let output = child.wait_with_output()?;
+    writer.join().expect("addr2line writer panicked")?;
+
+    let text = String::from_utf8_lossy(&output.stdout);
+    let mut lines = text.lines();
+
+    let mut names = HashMap::new();
+    for address in addresses {
+        let function = lines.next().unwrap_or("??");
+        _ = lines.next(); // file:line
+
+        let name = if function == "??" { format!("{:#x}", address) } else { function.to_string() };
+        names.insert(address, name);
+    }
+
+    Ok(names)
+}
+
+fn escape_json(text: &str) -> String {
+    let mut escaped = String::with_capacity(text.len());
+    for character in text.chars() {
+        match character {
+            '"' => escaped.push_str("\\\""),
+            '\\' => escaped.push_str("\\\\"),
+            character if (character as u32) < 0x20 => escaped.push_str(&format!("\\u{:04x}", character as u32)),
+            character => escaped.push(character),
+        }
+    }
+    escaped
+}
+
+fn write_chrome_trace(path: &Path, records: &[TraceRecord], names: &HashMap<u64, String>) -> Result<()> {
+    let start = records.iter().map(|record| record.nanoseconds).min().unwrap_or(0);
+    let mut writer = BufWriter::new(File::create(path)?);
+
+    writeln!(writer, "{{\"traceEvents\":[")?;
+    for (index, record) in records.iter().enumerate() {
+        let separator = if index + 1 == records.len() { "" } else { "," };
+        writeln!(
+            writer,
+            "{{\"name\":\"{}\",\"ph\":\"{}\",\"ts\":{:.3},\"pid\":1,\"tid\":{}}}{}",
+            escape_json(&names[&record.function]),
+            if record.exit { "E" } else { "B" },
+            (record.nanoseconds - start) as f64 / 1000.0,
+            record.thread,
+            separator
+        )?;
+    }
+    writeln!(writer, "],\"displayTimeUnit\":\"ns\"}}")?;
+
+    writer.flush()?;
+    Ok(())
+}
+
+/// every line is a call stack with the nanoseconds spent in its innermost function (self time)
+fn write_folded_stacks(path: &Path, records: &[TraceRecord], names: &HashMap<u64, String>) -> Result<()> {
+    let mut writer = BufWriter::new(File::create(path)?);
+    for (stack, nanoseconds) in fold_stacks(records, names) {
+        if nanoseconds > 0 {
+            writeln!(writer, "{} {}", stack, nanoseconds)?;
+        }
+    }
+
+    writer.flush()?;
+    Ok(())
+}
+
+/// self time per `caller;callee` stack, the calls of every thread are nested separately
+fn fold_stacks(records: &[TraceRecord], names: &HashMap<u64, String>) -> BTreeMap<String, u64> {
+    struct Frame {
+        function: u64,
+        entered:  u64,
+        children: u64,
+    }
+
+    let mut stacks: HashMap<u32, Vec<Frame>> = HashMap::new();
+    let mut folded: BTreeMap<String, u64> = BTreeMap::new();
+
+    let close_frame = |stack: &mut Vec<Frame>, now: u64, folded: &mut BTreeMap<String, u64>| {
+        let frame = stack.pop().unwrap();
+        let duration = now.saturating_sub(frame.entered);
+
+        let mut key: Vec<&str> = stack.iter().map(|parent| names[&parent.function].as_str()).collect();
+        key.push(&names[&frame.function]);
+        *folded.entry(key.join(";")).or_default() += duration.saturating_sub(frame.children);
+
+        if let Some(parent) = stack.last_mut() {
+            parent.children += duration;
+        }
+    };
+
+    for record in records {
+        let stack = stacks.entry(record.thread).or_default();
+        if !record.exit {
+            stack.push(Frame { function: record.function, entered: record.nanoseconds, children: 0 });
+            continue;
+        }
+
+        // frames left by a longjmp (or a trace that started mid call) get closed together with their caller
+        if stack.iter().any(|frame| frame.function == record.function) {
+            while stack.last().is_some_and(|frame| frame.function != record.function) {
+                close_frame(stack, record.nanoseconds, &mut folded);
+            }
+            close_frame(stack, record.nanoseconds, &mut folded);
+        }
+    }
+
+    // functions still running at exit, main itself when the program called exit()
+    let end = records.iter().map(|record| record.nanoseconds).max().unwrap_or(0);
+    for stack in stacks.values_mut() {
+        while !stack.is_empty() {
+            close_frame(stack, end, &mut folded);
+        }
+    }
+
+    folded
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    const ENTER: u32 = 0;
+    const EXIT: u32 = 1;
+
+    /// a trace as the runtime writes it, records are (nanoseconds, function, thread, kind)
+    fn trace(records: &[(u64, u64, u32, u32)]) -> Vec<u8> {
+        let mut data = FUNCTION_TRACE_MAGIC.to_vec();
+        data.extend(0x40_0000u64.to_le_bytes());
+        for &(nanoseconds, function, thread, kind) in records {
+            data.extend(nanoseconds.to_le_bytes());
+            data.extend(function.to_le_bytes());
+            data.extend(thread.to_le_bytes());
+            data.extend(kind.to_le_bytes());
+        }
+        data
+    }
+
+    fn names() -> HashMap<u64, String> {
+        HashMap::from([(1, "main".to_string()), (2, "parse".to_string()), (3, "lex".to_string())])
+    }
+
+    fn fold(records: &[(u64, u64, u32, u32)]) -> Vec<(String, u64)> {
+        let (_, records) = parse_function_trace(&trace(records)).unwrap();
+        fold_stacks(&records, &names()).into_iter().collect()
+    }
+
+    fn folded(stacks: &[(&str, u64)]) -> Vec<(String, u64)> {
+        stacks.iter().map(|(stack, nanoseconds)| (stack.to_string(), *nanoseconds)).collect()
+    }
+
+    #[test]
+    fn parses_records() {
+        let (load_address, records) = parse_function_trace(&trace(&[(100, 1, 7, ENTER), (250, 1, 7, EXIT)])).unwrap();
+        assert_eq!(load_address, 0x40_0000);
+        assert_eq!(records.len(), 2);
+        assert_eq!((records[0].nanoseconds, records[0].function, records[0].thread), (100, 1, 7));
+        assert!(!records[0].exit && records[1].exit);
+    }
+
+    #[test]
+    fn rejects_bad_magic_and_truncated_headers() {
+        let mut data = trace(&[]);
+        data[7] = b'2';
+        assert!(parse_function_trace(&data).is_err());
+        assert!(parse_function_trace(&trace(&[])[..12]).is_err());
+        assert!(parse_function_trace(&[]).is_err());
+    }
+
+    #[test]
+    fn drops_a_record_cut_off_at_exit() {
+        let data = trace(&[(100, 1, 7, ENTER), (250, 1, 7, EXIT)]);
+        let (_, records) = parse_function_trace(&data[..data.len() - 5]).unwrap();
+        assert_eq!(records.len(), 1);
+    }
+
+    #[test]
+    fn folds_self_time() {
+        let stacks = fold(&[
+            (0, 1, 1, ENTER),
+            (10, 2, 1, ENTER),
+            (15, 3, 1, ENTER),
+            (45, 3, 1, EXIT),
+            (60, 2, 1, EXIT),
+            (70, 3, 1, ENTER),
+            (80, 3, 1, EXIT),
+            (100, 1, 1, EXIT),
+        ]);
+
+        assert_eq!(stacks, folded(&[("main", 40), ("main;lex", 10), ("main;parse", 20), ("main;parse;lex", 30)]));
+    }
+
+    #[test]
+    fn nests_interleaved_threads_separately() {
+        let stacks = fold(&[
+            (0, 1, 1, ENTER),
+            (5, 2, 2, ENTER),
+            (10, 3, 1, ENTER),
+            (20, 3, 2, ENTER),
+            (30, 3, 1, EXIT),
+            (40, 3, 2, EXIT),
+            (50, 2, 2, EXIT),
+            (60, 1, 1, EXIT),
+        ]);
+
+        assert_eq!(stacks, folded(&[("main", 40), ("main;lex", 20), ("parse", 25), ("parse;lex", 20)]));
+    }
+
+    #[test]
+    fn tolerates_mismatched_enter_and_exit() {
+        let stacks = fold(&[
+            // an exit without its enter, the trace started inside lex
+            (0, 3, 1, EXIT),
+            (10, 1, 1, ENTER),
+            (20, 2, 1, ENTER),
+            (30, 3, 1, ENTER),
+            // lex never returned (longjmp), parse returning closes it too
+            (50, 2, 1, EXIT),
+            // main never returned (exit()), it is closed at the last record
+            (60, 3, 1, ENTER),
+            (70, 3, 1, EXIT),
+        ]);
+
+        assert_eq!(stacks, folded(&[("main", 20), ("main;lex", 10), ("main;parse", 10), ("main;parse;lex", 20)]));
+    }
+}
@@ -0,0 +1,531 @@
+use anyhow::{Context, Result, bail};
+use log::{debug, trace, warn};
+use owo_colors::OwoColorize;
+use std::collections::{HashMap, VecDeque};
+use std::fs::{self, File};
+use std::path::{Path, PathBuf};
+use std::process::{Command, Stdio};
+use std::sync::{Arc, Mutex};
+use std::thread;
+use std::time::{Duration, Instant, SystemTime, UNIX_EPOCH};
+
+/// written by the builder, one `name<tab>framework<tab>executable` line per test target
+const TEST_MANIFEST: &str = ".talon/tests.txt";
+/// durations and outcomes of previous runs, used for scheduling and for skipping unchanged tests
+const TEST_HISTORY: &str = ".talon/test_history.txt";
+const TEST_LOG_DIRECTORY: &str = ".talon/test_logs";
+
+pub struct TestOptions {
+    pub jobs:         usize,
+    /// zero based shard index and shard count
+    pub shard:        Option<(usize, usize)>,
+    pub timeout:      Option<Duration>,
+    pub filter:       Option<String>,
+    /// only runs tests whose executable changed since they last passed
+    pub changed_only: bool,
+    pub junit_path:   PathBuf,
+    /// only runs these test executables, every one in the manifest when None
+    pub executables:  Option<Vec<PathBuf>>,
+}
+
+#[derive(Clone, Copy, PartialEq, Debug)]
+enum Framework {
+    Plain,
+    Gtest,
+    Catch2,
+}
+
+struct TestExecutable {
+    name:      String,
+    framework: Framework,
+    path:      PathBuf,
+}
+
+/// a single schedulable test, either a whole executable or one case inside of it
+#[derive(Clone)]
+struct TestUnit {
+    id:           String,
+    suite:        String,
+    case:         String,
+    program:      PathBuf,
+    args:         Vec<String>,
+    binary_mtime: u64,
+}
+
+#[derive(Clone, Copy, PartialEq)]
+enum Outcome {
+    Passed,
+    Failed,
+    TimedOut,
+    Skipped,
+}
+
+struct TestResult {
+    unit:     TestUnit,
+    outcome:  Outcome,
+    duration: Duration,
+    log:      String,
+}
+
+struct HistoryEntry {
+    duration_ms:  u64,
+    binary_mtime: u64,
+    passed:       bool,
+}
+
+/// parses `INDEX/COUNT` with a one based index, e.g. `2/4`, used as a clap value parser
+pub fn parse_shard(value: &str) -> Result<(usize, usize), String> {
+    let (index, count) = value.split_once('/').ok_or("shard must be written as INDEX/COUNT, e.g. 1/4")?;
+    let index: usize = index.trim().parse().map_err(|_| "invalid shard index")?;
+    let count: usize = count.trim().parse().map_err(|_| "invalid shard count")?;
+
+    if count == 0 || index == 0 || index > count {
+        return Err(format!("shard index must be between 1 and {}", count));
+    }
+
+    Ok((index - 1, count))
+}
+
+/// when each test executable in the manifest was last linked, empty before the first build with tests
+pub fn test_executable_mtimes() -> HashMap<PathBuf, SystemTime> {
+    let executables = read_manifest(Path::new(TEST_MANIFEST)).unwrap_or_default();
+    executables
+        .into_iter()
+        .filter_map(|executable| {
+            let modified = fs::metadata(&executable.path).and_then(|metadata| metadata.modified()).ok()?;
+            Some((executable.path, modified))
+        })
+        .collect()
+}
+
+pub fn run_tests(options: &TestOptions) -> Result<()> {
+    let mut executables = read_manifest(Path::new(TEST_MANIFEST))?;
+    if executables.is_empty() {
+        println!("no test targets declared in the workspace");
+        return Ok(());
+    }
+
+    if let Some(selected) = &options.executables {
+        executables.retain(|executable| selected.contains(&executable.path));
+    }
+
+    let mut history = load_history(Path::new(TEST_HISTORY));
+
+    let mut units = Vec::new();
+    for executable in &executables {
+        units.extend(enumerate_units(executable)?);
+    }
+
+    if let Some(filter) = &options.filter {
+        units.retain(|unit| unit.id.contains(filter.as_str()));
+    }
+
+    // sharding happens on the sorted ids, so every shard sees the same split regardless of timing history
+    units.sort_by(|a, b| a.id.cmp(&b.id));
+    if let Some((index, count)) = options.shard {
+        units = units.into_iter().enumerate().filter(|(i, _)| i % count == index).map(|(_, unit)| unit).collect();
+    }
+
+    let mut results = Vec::new();
+    let mut queue = VecDeque::new();
+    for unit in units {
+        let unchanged =
+            history.get(&unit.id).is_some_and(|entry| entry.passed && entry.binary_mtime == unit.binary_mtime);
+
+        if options.changed_only && unchanged {
+            trace!("skipping unchanged test: {}", unit.id);
+            results.push(TestResult { unit, outcome: Outcome::Skipped, duration: Duration::ZERO, log: String::new() });
+        } else {
+            queue.push_back(unit);
+        }
+    }
+
+    // slowest first, tests without history are assumed to be slow so they do not end up as the long tail
+    let expected_duration = |unit: &TestUnit| history.get(&unit.id).map_or(u64::MAX, |entry| entry.duration_ms);
+    queue.make_contiguous().sort_by_key(|unit| std::cmp::Reverse(expected_duration(unit)));
+
+    fs::create_dir_all(TEST_LOG_DIRECTORY)?;
+
+    let total = queue.len();
+    let jobs = options.jobs.clamp(1, total.max(1));
+    println!("running {} test(s) on {} job(s)", total, jobs);
+
+    results.extend(execute_queue(queue, jobs, options.timeout));
+
+    for result in &results {
+        if result.outcome == Outcome::Skipped {
+            continue;
+        }
+
+        history.insert(
+            result.unit.id.clone(),
+            HistoryEntry {
+                duration_ms:  result.duration.as_millis() as u64,
+                binary_mtime: result.unit.binary_mtime,
+                passed:       result.outcome == Outcome::Passed,
+            },
+        );
+    }
+
+    save_history(Path::new(TEST_HISTORY), &history)?;
+    write_junit_report(&options.junit_path, &mut results)?;
+
+    let failed: Vec<_> = results.iter().filter(|r| matches!(r.outcome, Outcome::Failed | Outcome::TimedOut)).collect();
+    let skipped = results.iter().filter(|r| r.outcome == Outcome::Skipped).count();
+
+    for result in &failed {
+        eprintln!("\n---- {} ----\n{}", result.unit.id, result.log.trim_end());
+    }
+
+    println!(
+        "\n{} passed, {} failed, {} skipped, report written to {}",
+        results.len() - failed.len() - skipped,
+        failed.len(),
+        skipped,
+        options.junit_path.display()
+    );
+
+    if !failed.is_empty() {
+        bail!("{} of {} tests failed", failed.len(), results.len() - skipped);
+    }
+
+    Ok(())
+}
+
+fn execute_queue(queue: VecDeque<TestUnit>, jobs: usize, timeout: Option<Duration>) -> Vec<TestResult> {
+    let queue = Arc::new(Mutex::new(queue));
+    let results = Arc::new(Mutex::new(Vec::new()));
+
+    let workers: Vec<_> = (0..jobs)
+        .map(|_| {
+            let queue = Arc::clone(&queue);
+            let results = Arc::clone(&results);
+
+            thread::spawn(move || {
+                loop {
+                    let Some(unit) = queue.lock().unwrap().pop_front() else { break };
+
+                    let result = run_unit(unit, timeout);
+                    print_result(&result);
+                    results.lock().unwrap().push(result);
+                }
+            })
+        })
+        .collect();
+
+    for worker in workers {
+        _ = worker.join();
+    }
+
+    Arc::try_unwrap(results).map(|results| results.into_inner().unwrap()).unwrap_or_default()
+}
+
+fn run_unit(unit: TestUnit, timeout: Option<Duration>) -> TestResult {
+    let log_path = Path::new(TEST_LOG_DIRECTORY).join(format!("{}.log", sanitize_file_name(&unit.id)));
+    let started = Instant::now();
+
+    let outcome = match spawn_and_wait(&unit, &log_path, timeout) {
+        Ok(outcome) => outcome,
+        Err(err) => {
+            warn!("failed to run test {}: {:?}", unit.id, err);
+            Outcome::Failed
+        }
+    };
+
+    let duration = started.elapsed();
+    let log = fs::read_to_string(&log_path).unwrap_or_default();
+    TestResult { unit, outcome, duration, log }
+}
+
+fn spawn_and_wait(unit: &TestUnit, log_path: &Path, timeout: Option<Duration>) -> Result<Outcome> {
+    // output goes to a file rather than a pipe, a chatty test can not block on a full pipe while we poll it
+    let log_file = File::create(log_path)?;
+    let mut child = Command::new(&unit.program)
+        .args(&unit.args)
+        .stdin(Stdio::null())
+        .stdout(log_file.try_clone()?)
+        .stderr(log_file)
+        .spawn()
+        .with_context(|| format!("failed to start {}", unit.program.display()))?;
+
+    let started = Instant::now();
+    loop {
+        if let Some(status) = child.try_wait()? {
+            return Ok(if status.success() { Outcome::Passed } else { Outcome::Failed });
+        }
+
+        if let Some(limit) = timeout
+            && started.elapsed() >= limit
+        {
+            _ = child.kill();
+            _ = child.wait();
+            return Ok(Outcome::TimedOut);
+        }
+
+        thread::sleep(Duration::from_millis(5));
+    }
+}
+
+fn print_result(result: &TestResult) {
+    let milliseconds = result.duration.as_millis();
+    match result.outcome {
+        Outcome::Passed => println!("{} {} ({} ms)", "PASS".green(), result.unit.id, milliseconds),
+        Outcome::Failed => println!("{} {} ({} ms)", "FAIL".red(), result.unit.id, milliseconds),
+        Outcome::TimedOut => println!("{} {} ({} ms)", "TIMEOUT".red(), result.unit.id, milliseconds),
+        Outcome::Skipped => {}
+    }
+}
+
+fn read_manifest(path: &Path) -> Result<Vec<TestExecutable>> {
+    let content =
+        fs::read_to_string(path).with_context(|| format!("failed to read test manifest: {}", path.display()))?;
+
+    let mut executables = Vec::new();
+    for line in content.lines().filter(|line| !line.is_empty()) {
+        let fields: Vec<&str> = line.split('\t').collect();
+        let [name, framework, executable] = fields[..] else {
+            warn!("malformed test manifest line: {}", line);
+            continue;
+        };
+
+        let framework = match framework {
+            "gtest" => Framework::Gtest,
+            "catch2" => Framework::Catch2,
+            _ => Framework::Plain,
+        };
+
+        executables.push(TestExecutable { name: name.to_string(), framework, path: PathBuf::from(executable) });
+    }
+
+    Ok(executables)
+}
+
+fn enumerate_units(executable: &TestExecutable) -> Result<Vec<TestUnit>> {
+    let binary_mtime = fs::metadata(&executable.path)
+        .and_then(|metadata| metadata.modified())
+        .map(|time| time.duration_since(UNIX_EPOCH).unwrap_or_default().as_millis() as u64)
+        .with_context(|| format!("test executable missing: {}", executable.path.display()))?;
+
+    let whole_executable = |case: &str, args: Vec<String>| TestUnit {
+        id: format!("{}::{}", executable.name, case),
+        suite: executable.name.clone(),
+        case: case.to_string(),
+        program: executable.path.clone(),
+        args,
+        binary_mtime,
+    };
+
+    let cases = match executable.framework {
+        Framework::Plain => None,
+        Framework::Gtest => list_gtest_cases(&executable.path),
+        Framework::Catch2 => list_catch2_cases(&executable.path),
+    };
+
+    let Some(cases) = cases.filter(|cases| !cases.is_empty()) else {
+        if executable.framework != Framework::Plain {
+            warn!("could not list the cases of {}, running it as a single test", executable.name);
+        }
+
+        return Ok(vec![TestUnit { id: executable.name.clone(), ..whole_executable(&executable.name, Vec::new()) }]);
+    };
+
+    debug!("{} has {} test case(s)", executable.name, cases.len());
+    Ok(cases
+        .into_iter()
+        .map(|case| {
+            let args = match executable.framework {
+                Framework::Gtest => vec![format!("--gtest_filter={}", case)],
+                _ => vec![escape_catch2_name(&case)],
+            };
+
+            whole_executable(&case, args)
+        })
+        .collect())
+}
+
+/// `--gtest_list_tests` prints suites unindented with a trailing dot and their cases indented below them
+fn list_gtest_cases(executable: &Path) -> Option<Vec<String>> {
+    let output = Command::new(executable).arg("--gtest_list_tests").output().ok()?;
+    if !output.status.success() {
+        return None;
+    }
+
+    Some(parse_gtest_list(&String::from_utf8_lossy(&output.stdout)))
+}
+
+fn parse_gtest_list(listing: &str) -> Vec<String> {
+    let mut cases = Vec::new();
+    let mut suite = String::new();
+    for line in listing.lines() {
+        let Some(name) = line.split_whitespace().next() else { continue };
+
+        if line.starts_with(' ') {
+            cases.push(format!("{}{}", suite, name));
+        } else {
+            suite = name.to_string();
+        }
+    }
+
+    cases
+}
+
+/// catch2 v3 lists names with `--list-tests --verbosity quiet`, v2 with `--list-test-names-only`. v2 exits with the
+/// number of listed tests rather than 0, so there only a crash or an empty listing counts as failure
+fn list_catch2_cases(executable: &Path) -> Option<Vec<String>> {
+    let attempts: [(&[&str], bool); 2] =
+        [(&["--list-tests", "--verbosity", "quiet"], true), (&["--list-test-names-only"], false)];
+
+    attempts.iter().find_map(|(args, requires_success)| {
+        let output = Command::new(executable).args(*args).output().ok()?;
+        let failed = if *requires_success { !output.status.success() } else { output.status.code().is_none() };
+        if failed {
+            return None;
+        }
+
+        let cases = parse_catch2_list(&String::from_utf8_lossy(&output.stdout));
+        (!cases.is_empty()).then_some(cases)
+    })
+}
+
+fn parse_catch2_list(listing: &str) -> Vec<String> {
+    listing.lines().map(str::trim).filter(|line| !line.is_empty()).map(str::to_string).collect()
+}
+
+/// catch2 treats commas, brackets and backslashes in a test spec as syntax
+fn escape_catch2_name(name: &str) -> String {
+    let mut escaped = String::with_capacity(name.len());
+    for character in name.chars() {
+        if matches!(character, ',' | '[' | ']' | '\\' | '*') {
+            escaped.push('\\');
+        }
+
+        escaped.push(character);
+    }
+
+    escaped
+}
+
+fn sanitize_file_name(id: &str) -> String {
+    id.chars().map(|c| if c.is_ascii_alphanumeric() || c == '-' || c == '_' || c == '.' { c } else { '_' }).collect()
+}
+
+fn load_history(path: &Path) -> HashMap<String, HistoryEntry> {
+    let Ok(content) = fs::read_to_string(path) else {
+        debug!("no test history found");
+        return HashMap::new();
+    };
+
+    content
+        .lines()
+        .filter_map(|line| {
+            let mut fields = line.split('\t');
+            let id = fields.next()?.to_string();
+            let duration_ms = fields.next()?.parse().ok()?;
+            let binary_mtime = fields.next()?.parse().ok()?;
+            let passed = fields.next()? == "1";
+            Some((id, HistoryEntry { duration_ms, binary_mtime, passed }))
+        })
+        .collect()
+}
+
+fn save_history(path: &Path, history: &HashMap<String, HistoryEntry>) -> Result<()> {
+    let mut ids: Vec<_> = history.keys().collect();
+    ids.sort();
+
+    let mut content = String::new();
+    for id in ids {
+        let entry = &history[id];
+        content += &format!("{}\t{}\t{}\t{}\n", id, entry.duration_ms, entry.binary_mtime, u8::from(entry.passed));
+    }
+
+    fs::write(path, content).with_context(|| format!("failed to write test history: {}", path.display()))
+}
+
+fn write_junit_report(path: &Path, results: &mut [TestResult]) -> Result<()> {
+    results.sort_by(|a, b| (&a.unit.suite, &a.unit.case).cmp(&(&b.unit.suite, &b.unit.case)));
+
+    let mut report = String::from("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<testsuites>\n");
+    for suite in results.chunk_by(|a, b| a.unit.suite == b.unit.suite) {
+        let count = |outcome: Outcome| suite.iter().filter(|r| r.outcome == outcome).count();
+        let seconds: f64 = suite.iter().map(|r| r.duration.as_secs_f64()).sum();
+
+        report += &format!(
+            "  <testsuite name=\"{}\" tests=\"{}\" failures=\"{}\" errors=\"{}\" skipped=\"{}\" time=\"{:.3}\">\n",
+            escape_xml(&suite[0].unit.suite),
+            suite.len(),
+            count(Outcome::Failed),
+            count(Outcome::TimedOut),
+            count(Outcome::Skipped),
+            seconds
+        );
+
+        for result in suite {
+            report += &format!(
+                "    <testcase classname=\"{}\" name=\"{}\" time=\"{:.3}\"",
+                escape_xml(&result.unit.suite),
+                escape_xml(&result.unit.case),
+                result.duration.as_secs_f64()
+            );
+
+            let log = format!("<![CDATA[{}]]>", result.log.replace("]]>", "]]]]><![CDATA[>"));
+            match result.outcome {
+                Outcome::Passed => report += " />\n",
+                Outcome::Skipped => {
+                    report += ">\n      <skipped message=\"unchanged since last pass\" />\n    </testcase>\n"
+                }
+                Outcome::Failed => {
+                    report += &format!(">\n      <failure message=\"test failed\">{}</failure>\n    </testcase>\n", log)
+                }
+                Outcome::TimedOut => {
+                    report += &format!(">\n      <error message=\"test timed out\">{}</error>\n    </testcase>\n", log)
+                }
+            }
+        }
+
+        report += "  </testsuite>\n";
+    }
+
+    report += "</testsuites>\n";
+
+    if let Some(parent) = path.parent() {
+        fs::create_dir_all(parent)?;
+    }
+
+    fs::write(path, report).with_context(|| format!("failed to write junit report: {}", path.display()))
+}
+
+fn escape_xml(text: &str) -> String {
+    text.replace('&', "&amp;").replace('<', "&lt;").replace('>', "&gt;").replace('"', "&quot;")
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn parses_shards() {
+        assert_eq!(parse_shard("1/4"), Ok((0, 4)));
+        assert_eq!(parse_shard(" 4 / 4 "), Ok((3, 4)));
+    }
+
+    #[test]
+    fn rejects_out_of_range_shards() {
+        assert!(parse_shard("0/4").is_err());
+        assert!(parse_shard("5/4").is_err());
+        assert!(parse_shard("1/0").is_err());
+        assert!(parse_shard("2").is_err());
+        assert!(parse_shard("a/b").is_err());
+    }
+
+    #[test]
+    fn parses_gtest_listings() {
+        let listing = "Math.\n  Adds\n  Subtracts\nTyped/0.  # TypeParam = int\n  Works\n\nStrings.\n  Empty  # GetParam() = \"\"\n";
+        assert_eq!(parse_gtest_list(listing), ["Math.Adds", "Math.Subtracts", "Typed/0.Works", "Strings.Empty"]);
+    }
+
+    #[test]
+    fn parses_catch2_listings() {
+        let listing = "first case\n  indented case, with comma\n\n[tagged] case\n";
+        assert_eq!(parse_catch2_list(listing), ["first case", "indented case, with comma", "[tagged] case"]);
+    }
+}
@@ -5,9 +5,12 @@
 #endif
 
 #include <algorithm>
+#include <array>
+#include <cstddef>
 #include <cstdint>
-#include <functional>
 #include <string_view>
+#include <utility>
+#include <vector>
 
 namespace talon {
 
@@ -74,6 +77,13 @@ enum class sanitizer_mode : uint8_t {
     address_and_undefined,
 };
 
+// function level tracing for 'talon profile', independent of the sanitizer
+enum class instrumentation_mode : uint8_t {
+    none,
+    xray,      // clang only, -fxray-instrument, sleds are patched in at runtime so an idle binary runs at full speed
+    functions, // -finstrument-functions, every function calls into a small trace runtime linked by talon
+};
+
 enum class optimize_level : uint8_t {
     debug,     // -Og
     size,      // -Os
@@ -87,6 +97,40 @@ enum class output_mode : uint8_t {
     dynamic_library,
 };
 
+// decides how 'talon test' finds and runs the individual cases of a test executable
+enum class test_framework : uint8_t {
+    plain, // the whole executable is one test, a non-zero exit code fails it
+    gtest,
+    catch2,
+};
+
+[[nodiscard]] constexpr auto to_string_view(const test_framework framework) noexcept -> std::string_view
+{
+    switch (framework) {
+    case test_framework::plain: return "plain";
+    case test_framework::gtest: return "gtest";
+    case test_framework::catch2: return "catch2";
+    }
+
+    return {};
+}
+
+// how 'talon bench' reads the results of a benchmark executable
+enum class benchmark_format : uint8_t {
+    lines,            // every 'bench <name> <value> <ns|us|ms|s>' line on stdout is one sample
+    google_benchmark, // run with --benchmark_format=json, every iteration run is one sample
+};
+
+[[nodiscard]] constexpr auto to_string_view(const benchmark_format format) noexcept -> std::string_view
+{
+    switch (format) {
+    case benchmark_format::lines: return "lines";
+    case benchmark_format::google_benchmark: return "google_benchmark";
+    }
+
+    return {};
+}
+
 enum class build_systems : uint8_t {
     ninja,
 };
@@ -110,10 +154,33 @@ struct build_options {
     output_mode output_type = output_mode::executable;
     link_mode link_mode = link_mode::dynamically;
     sanitizer_mode sanitizer = sanitizer_mode::none;
+    instrumentation_mode instrumentation = instrumentation_mode::none;
     optimize_level optimization = optimize_level::debug;
 
+    // xray only: functions with fewer instructions are left alone, and special case lists ('fun:name*' and
+    // 'src:file*' lines) forcing functions in or out regardless of the threshold
+    uint32_t xray_instruction_threshold = 200;
+    std::string_view xray_always_instrument;
+    std::string_view xray_never_instrument;
+
     bool print_build_script = false;
 
+    // static libraries reference their objects instead of copying them in, gcc/clang only
+    bool thin_archives = false;
+
+    // debug executables get linked as one shared library per top-level source directory, so an edit only relinks
+    // its own library. gcc/clang on linux only, builds with optimizations stay monolithic
+    bool split_linking = false;
+
+    // release codegen and link settings for long running binaries: no plt, no semantic interposition, unused
+    // functions and data collected by the linker, symbols bound at startup and segments aligned to 2MiB so the text
+    // can be backed by transparent huge pages. what each compiler and platform gets is decided in parse_*_flags
+    bool runtime_performance = false;
+
+    // static library of a malloc replacement (mimalloc, jemalloc, tcmalloc), linked as a whole ahead of everything
+    // else so its malloc/free win over the libc ones
+    std::string_view allocator_library;
+
     // @Todo: maybe it would be good to have a check here,
     // to see what stage the token is used in, for example: "compile" or "build"
     // or even "compile and build"
@@ -128,10 +195,22 @@ struct build_options {
         bool enabled = false;
 
         std::string_view msvc_flag;
+        std::string_view gcc_flag;
         std::string_view clang_flag;
 
         compile_section section;
 
+        [[nodiscard]] constexpr auto flag_for(const compilers compiler) const noexcept -> std::string_view
+        {
+            switch (compiler) {
+            case compilers::gcc: return gcc_flag;
+            case compilers::msvc: return msvc_flag;
+            case compilers::clang: return clang_flag;
+            }
+
+            return {};
+        }
+
         constexpr auto operator=(const bool value) noexcept -> compile_option &
         {
             enabled = value;
@@ -146,239 +225,252 @@ struct build_options {
 
     compile_option warn_all = {
         .msvc_flag = "/Wall",
+        .gcc_flag = "-Wall",
         .clang_flag = "-Wall",
         .section = compile_section::build,
     };
 
     compile_option warn_extra = {
         .msvc_flag = "/W4",
+        .gcc_flag = "-Wextra",
         .clang_flag = "-Wextra",
         .section = compile_section::build,
     };
 
     compile_option warn_extra_tokens = {
         .msvc_flag = {},
+        .gcc_flag = {},
         .clang_flag = "-Wextra-tokens",
         .section = compile_section::build,
     };
 
     compile_option warn_pedantic = {
         .msvc_flag = "/permissive-",
+        .gcc_flag = "-Wpedantic",
         .clang_flag = "-Wpedantic",
         .section = compile_section::build,
     };
 
     compile_option warn_old_style_casts = {
         .msvc_flag = {},
+        .gcc_flag = "-Wold-style-cast",
         .clang_flag = "-Wold-style-cast",
         .section = compile_section::build,
     };
 
     compile_option warn_cast_qualifiers = {
         .msvc_flag = {},
+        .gcc_flag = "-Wcast-qual",
         .clang_flag = "-Wcast-qual",
         .section = compile_section::build,
     };
 
     compile_option warnings_are_errors = {
         .msvc_flag = "/WX",
+        .gcc_flag = "-Werror",
         .clang_flag = "-Werror",
         .section = compile_section::build,
     };
 
     compile_option warn_unused = {
         .msvc_flag = "/wd4101 /wd4102 /wd4189",
+        .gcc_flag = "-Wunused",
         .clang_flag = "-Wunused",
         .section = compile_section::build,
     };
 
     compile_option warn_uninitialized = {
         .msvc_flag = "/we4700",
+        .gcc_flag = "-Wuninitialized",
         .clang_flag = "-Wuninitialized",
         .section = compile_section::build,
     };
 
     compile_option warn_array_bounds = {
         .msvc_flag = {},
+        .gcc_flag = "-Warray-bounds",
         .clang_flag = "-Warray-bounds",
         .section = compile_section::build,
     };
 
     compile_option warn_sign_conversion = {
         .msvc_flag = "/we4365",
+        .gcc_flag = "-Wsign-conversion",
         .clang_flag = "-Wsign-conversion",
         .section = compile_section::build,
     };
 
     compile_option warn_from_system_headers = {
         .msvc_flag = "/external:W4",
+        .gcc_flag = "-Wsystem-headers",
         .clang_flag = "-Wsystem-headers",
         .section = compile_section::build,
     };
 
     compile_option warn_shadow = {
         .msvc_flag = "/we4456 /we4457 /we4458 /we4459",
+        .gcc_flag = "-Wshadow",
         .clang_flag = "-Wshadow",
         .section = compile_section::build,
     };
 
     compile_option warn_non_virtual_dtor = {
         .msvc_flag = "/we4265",
+        .gcc_flag = "-Wnon-virtual-dtor",
         .clang_flag = "-Wnon-virtual-dtor",
         .section = compile_section::build,
     };
 
     compile_option warn_conversion = {
         .msvc_flag = "/we4244 /we4267",
+        .gcc_flag = "-Wconversion",
         .clang_flag = "-Wconversion",
         .section = compile_section::build,
     };
 
     compile_option warn_misleading_indentation = {
         .msvc_flag = {},
+        .gcc_flag = "-Wmisleading-indentation",
         .clang_flag = "-Wmisleading-indentation",
         .section = compile_section::build,
     };
 
     compile_option warn_null_dereference = {
         .msvc_flag = {},
+        .gcc_flag = "-Wnull-dereference",
         .clang_flag = "-Wnull-dereference",
         .section = compile_section::build,
     };
 
     compile_option warn_implicit_fallthrough = {
         .msvc_flag = "/we5262",
+        .gcc_flag = "-Wimplicit-fallthrough",
         .clang_flag = "-Wimplicit-fallthrough",
         .section = compile_section::build,
     };
 
     compile_option error_pedantic = {
         .msvc_flag = "/permissive-",
+        .gcc_flag = "-pedantic-errors",
         .clang_flag = "-pedantic-errors",
         .section = compile_section::build,
     };
 
     compile_option strip_executable_symbols = {
         .msvc_flag = "/DEBUG:NONE",
+        .gcc_flag = "-s",
         .clang_flag = "-s",
         .section = compile_section::build,
     };
 
     compile_option link_time_optimization = {
         .msvc_flag = "/LTCG",
+        .gcc_flag = "-flto",
         .clang_flag = "-flto",
         .section = compile_section::build,
     };
 
     compile_option debug_symbols = {
         .msvc_flag = "/Zi",
+        .gcc_flag = "-g",
         .clang_flag = "-g",
         .section = compile_section::build,
     };
 
     compile_option warn_undef = {
         .msvc_flag = {},
+        .gcc_flag = "-Wundef",
         .clang_flag = "-Wundef",
         .section = compile_section::build,
     };
 
     compile_option warn_float_equal = {
         .msvc_flag = {},
+        .gcc_flag = "-Wfloat-equal",
         .clang_flag = "-Wfloat-equal",
         .section = compile_section::build,
     };
 
     compile_option warn_pointer_arith = {
         .msvc_flag = {},
+        .gcc_flag = "-Wpointer-arith",
         .clang_flag = "-Wpointer-arith",
         .section = compile_section::build,
     };
 
     compile_option warn_cast_align = {
         .msvc_flag = {},
+        .gcc_flag = "-Wcast-align=strict",
         .clang_flag = "-Wcast-align",
         .section = compile_section::build,
     };
 
     compile_option warn_switch_default = {
         .msvc_flag = "/w14062",
+        .gcc_flag = "-Wswitch-default",
         .clang_flag = "-Wswitch-default",
         .section = compile_section::build,
     };
 
     compile_option warn_switch_enum = {
         .msvc_flag = "/w14061",
+        .gcc_flag = "-Wswitch-enum",
         .clang_flag = "-Wswitch-enum",
         .section = compile_section::build,
     };
 
     compile_option warn_unreachable_code = {
         .msvc_flag = "/w14702",
+        .gcc_flag = {},
         .clang_flag = "-Wunreachable-code",
         .section = compile_section::build,
     };
 
     compile_option warn_aggregate_return = {
         .msvc_flag = {},
+        .gcc_flag = "-Waggregate-return",
         .clang_flag = "-Waggregate-return",
         .section = compile_section::build,
     };
 
     compile_option warn_write_strings = {
         .msvc_flag = {},
+        .gcc_flag = "-Wwrite-strings",
         .clang_flag = "-Wwrite-strings",
         .section = compile_section::build,
     };
 
     compile_option save_temps = {
         .msvc_flag = "/EP",
+        .gcc_flag = "-save-temps",
         .clang_flag = "-save-temps",
         .section = compile_section::build,
     };
 
     compile_option warn_strict_prototypes = {
         .msvc_flag = {},
+        .gcc_flag = {},
         .clang_flag = "-Wstrict-prototypes",
         .section = compile_section::build,
     };
 
     compile_option warn_missing_prototypes = {
         .msvc_flag = {},
+        .gcc_flag = "-Wmissing-declarations",
         .clang_flag = "-Wmissing-prototypes",
         .section = compile_section::build,
     };
 
     compile_option warn_old_style_definition = {
         .msvc_flag = {},
+        .gcc_flag = {},
         .clang_flag = "-Wold-style-definition",
         .section = compile_section::build,
     };
 
-    TALON_API auto visit_options(std::function<void(const compile_option &)> &&visitor) const -> void
-    {
-        visitor(warn_all);
-        visitor(warn_extra);
-        visitor(warn_extra_tokens);
-        visitor(warn_pedantic);
-        visitor(warn_old_style_casts);
-        visitor(warn_cast_qualifiers);
-        visitor(warnings_are_errors);
-        visitor(warn_unused);
-        visitor(warn_uninitialized);
-        visitor(warn_array_bounds);
-        visitor(warn_sign_conversion);
-        visitor(warn_from_system_headers);
-        visitor(warn_shadow);
-        visitor(warn_non_virtual_dtor);
-        visitor(warn_conversion);
-        visitor(warn_misleading_indentation);
-        visitor(warn_null_dereference);
-        visitor(warn_implicit_fallthrough);
-        visitor(error_pedantic);
-        visitor(strip_executable_symbols);
-        visitor(link_time_optimization);
-        visitor(debug_symbols);
-    }
+    // walks build_option_table, see below
+    template <typename Visitor>
+    constexpr auto visit_options(Visitor &&visitor) const -> void;
 
     inline TALON_API auto enable_recommended_warnings() noexcept -> void
     {
@@ -392,4 +484,72 @@ struct build_options {
     }
 };
 
+// every compile_option member of build_options, in declaration order. flag rendering only walks this
+// table, so the asserts below make sure nothing declared can be left out of it
+inline constexpr std::array build_option_table = {
+    &build_options::warn_all,
+    &build_options::warn_extra,
+    &build_options::warn_extra_tokens,
+    &build_options::warn_pedantic,
+    &build_options::warn_old_style_casts,
+    &build_options::warn_cast_qualifiers,
+    &build_options::warnings_are_errors,
+    &build_options::warn_unused,
+    &build_options::warn_uninitialized,
+    &build_options::warn_array_bounds,
+    &build_options::warn_sign_conversion,
+    &build_options::warn_from_system_headers,
+    &build_options::warn_shadow,
+    &build_options::warn_non_virtual_dtor,
+    &build_options::warn_conversion,
+    &build_options::warn_misleading_indentation,
+    &build_options::warn_null_dereference,
+    &build_options::warn_implicit_fallthrough,
+    &build_options::error_pedantic,
+    &build_options::strip_executable_symbols,
+    &build_options::link_time_optimization,
+    &build_options::debug_symbols,
+    &build_options::warn_undef,
+    &build_options::warn_float_equal,
+    &build_options::warn_pointer_arith,
+    &build_options::warn_cast_align,
+    &build_options::warn_switch_default,
+    &build_options::warn_switch_enum,
+    &build_options::warn_unreachable_code,
+    &build_options::warn_aggregate_return,
+    &build_options::warn_write_strings,
+    &build_options::save_temps,
+    &build_options::warn_strict_prototypes,
+    &build_options::warn_missing_prototypes,
+    &build_options::warn_old_style_definition,
+};
+
+namespace detail {
+
+consteval auto build_option_table_is_ordered() -> bool
+{
+    const build_options opts{};
+    for (std::size_t i = 1; i < build_option_table.size(); ++i) {
+        if (&(opts.*build_option_table[i - 1]) >= &(opts.*build_option_table[i])) return false;
+    }
+
+    return true;
+}
+
+} // namespace detail
+
+// compile options have to stay the last members of build_options for this count to hold
+static_assert(build_option_table.size() ==
+                  (sizeof(build_options) - offsetof(build_options, warn_all)) / sizeof(build_options::compile_option),
+              "a compile_option was added to build_options without being listed in build_option_table");
+static_assert(detail::build_option_table_is_ordered(), "build_option_table must follow the declaration order of build_options");
+
+template <typename Visitor>
+constexpr auto build_options::visit_options(Visitor &&visitor) const -> void
+{
+    for (const auto option : build_option_table) {
+        visitor(this->*option);
+    }
+}
+
 } // namespace talon
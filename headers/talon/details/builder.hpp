@@ -12,10 +12,16 @@ struct build_script_builder {
     [[nodiscard]] virtual auto get_script() const -> std::string = 0;
 
     virtual auto add_variable(std::string_view name, std::string_view value) -> void = 0;
+    // restat, outputs the command left untouched do not dirty the edges depending on them
     virtual auto add_rule(std::string_view name, std::string_view command, std::string_view description = "", std::string_view depfile = "",
-                          std::string_view deps = "") -> void = 0;
+                          std::string_view deps = "", bool restat = false) -> void = 0;
     virtual auto add_build_edge(std::string_view output, std::string_view rule, std::string_view inputs) -> void = 0;
 
+    // implicit inputs are dependencies that stay out of $in, order only inputs have to exist before the edge runs
+    // but changing them does not rebuild it
+    virtual auto add_build_edge(std::string_view output, std::string_view rule, std::string_view inputs, std::string_view implicit_inputs,
+                                std::string_view order_only_inputs = "") -> void = 0;
+
   protected:
     std::stringstream script_stream_;
 };
@@ -37,7 +43,7 @@ struct ninja_builder final : build_script_builder {
     }
 
     auto add_rule(std::string_view name, std::string_view command, std::string_view description, std::string_view depfile,
-                  std::string_view deps) -> void override
+                  std::string_view deps, bool restat) -> void override
     {
         script_stream_ << "\nrule " << name << "\n";
         script_stream_ << "  command = " << command << "\n";
@@ -50,12 +56,23 @@ struct ninja_builder final : build_script_builder {
 
         const bool has_description = !description.empty();
         if (has_description) script_stream_ << "  description = " << description << '\n';
+
+        if (restat) script_stream_ << "  restat = 1\n";
     }
 
     auto add_build_edge(std::string_view output, std::string_view rule, std::string_view inputs) -> void override
     {
         script_stream_ << "\nbuild " << output << ": " << rule << ' ' << inputs << '\n';
     }
+
+    auto add_build_edge(std::string_view output, std::string_view rule, std::string_view inputs, std::string_view implicit_inputs,
+                        std::string_view order_only_inputs) -> void override
+    {
+        script_stream_ << "\nbuild " << output << ": " << rule << ' ' << inputs;
+        if (!implicit_inputs.empty()) script_stream_ << " | " << implicit_inputs;
+        if (!order_only_inputs.empty()) script_stream_ << " || " << order_only_inputs;
+        script_stream_ << '\n';
+    }
 };
 
 } // namespace talon
@@ -0,0 +1,376 @@
+#pragma once
+
+#ifndef TALON_API
+#define TALON_API
+#endif
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <iterator>
+#include <optional>
+#include <ranges>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "build_options.hpp"
+#include "builder.hpp"
+#include "helpers.hpp"
+
+namespace talon {
+
+// a vendored library (abseil, fmt, a boost subset) described like a small workspace of its own. it gets built as a
+// static library once per machine for every abi relevant configuration, the compiler (and its version),
+// cpp_version, optimization, sanitizer and link mode, plus the contents of its tree. every project with a matching
+// configuration links that build instead of compiling the library again. header-only trees (no sources in the
+// source directories) only get their headers cached
+struct dependency_target {
+    std::string_view name;
+    std::string_view root;                             // the vendored tree, relative to the project
+    std::vector<std::string_view> source_directories;  // relative to root, searched recursively
+    std::vector<std::string_view> include_directories; // relative to root, copied into the cache next to the library
+    std::vector<std::string_view> definitions;
+};
+
+namespace detail {
+
+struct prebuilt_dependency {
+    fs::path include_directory;
+    fs::path library; // empty for header-only dependencies
+};
+
+// fnv-1a, enough to tell configurations and trees apart, nothing hashed here is adversarial
+struct fnv1a_hash {
+    uint64_t value = 14695981039346656037ull;
+
+    constexpr auto update(std::string_view data) noexcept -> void
+    {
+        for (const auto character : data) {
+            value ^= static_cast<uint8_t>(character);
+            value *= 1099511628211ull;
+        }
+    }
+};
+
+// shared by every project of the user, $XDG_CACHE_HOME or ~/.cache on linux, ~/Library/Caches on macos and
+// %LOCALAPPDATA% on windows
+[[nodiscard]] inline TALON_API auto user_cache_directory() -> std::optional<fs::path>
+{
+    const auto from_environment = [](const char *name) -> std::optional<fs::path> {
+        const char *value = std::getenv(name);
+        if (value == nullptr || *value == '\0') return std::nullopt;
+        return fs::path{value};
+    };
+
+    if constexpr (os == platform::windows_os) {
+        return from_environment("LOCALAPPDATA").transform([](const fs::path &path) { return path / "talon"; });
+    } else if constexpr (os == platform::mac_os) {
+        return from_environment("HOME").transform([](const fs::path &path) { return path / "Library/Caches/talon"; });
+    } else {
+        if (const auto cache = from_environment("XDG_CACHE_HOME")) return *cache / "talon";
+        return from_environment("HOME").transform([](const fs::path &path) { return path / ".cache/talon"; });
+    }
+}
+
+// the first line of '<compiler> --version', msvc reports its toolset through the developer prompt instead. starting
+// the compiler would cost every no-op build a process spawn, so the line is remembered in stamp_file together with
+// the resolved path and write time of the compiler binary, an update of the compiler changes the latter
+[[nodiscard]] inline TALON_API auto compiler_identity(const compilers compiler, const fs::path &stamp_file) -> std::string
+{
+    if (compiler == compilers::msvc) {
+        const char *toolset = std::getenv("VCToolsVersion");
+        return toolset != nullptr ? std::format("msvc {}", toolset) : "msvc";
+    }
+
+    std::string binary;
+    if (const auto found = find_in_path(compiler_to_statement(compiler))) {
+        std::error_code error;
+        const auto resolved = fs::canonical(*found, error);
+        const auto write_time = fs::last_write_time(resolved, error);
+        if (!error) binary = std::format("{} {}", resolved.string(), write_time.time_since_epoch().count());
+    }
+
+    if (std::ifstream stamp{stamp_file}; stamp && !binary.empty()) {
+        std::string previous_binary;
+        std::string identity;
+        if (std::getline(stamp, previous_binary) && std::getline(stamp, identity) && previous_binary == binary) return identity;
+    }
+
+    const auto output = capture_command_output(std::format("{} --version", compiler_to_statement(compiler)));
+    if (!output) return std::string{compiler_to_statement(compiler)};
+
+    auto identity = output->substr(0, output->find('\n'));
+    if (!binary.empty()) {
+        std::error_code error;
+        fs::create_directories(stamp_file.parent_path(), error);
+        std::ofstream{stamp_file} << binary << '\n' << identity << '\n';
+    }
+
+    return identity;
+}
+
+// relative path and contents of every file in the tree. hashing a large tree on every build would cost more than
+// it saves, so the hash is remembered next to the project together with the file count, total size and newest
+// write time, and only recomputed when one of those moved
+[[nodiscard]] inline TALON_API auto hash_dependency_tree(const fs::path &root, const fs::path &stamp_file) -> uint64_t
+{
+    std::vector<fs::path> files;
+    uintmax_t total_size = 0;
+    auto newest_write = fs::file_time_type::min();
+
+    std::error_code error;
+    for (auto it = fs::recursive_directory_iterator{root, error}; !error && it != fs::recursive_directory_iterator{}; it.increment(error)) {
+        if (it->path().filename().string().starts_with('.')) {
+            if (it->is_directory()) it.disable_recursion_pending();
+            continue;
+        }
+
+        if (!it->is_regular_file()) continue;
+
+        files.push_back(it->path());
+        total_size += it->file_size();
+        newest_write = std::max(newest_write, it->last_write_time());
+    }
+
+    std::ranges::sort(files);
+    const auto summary = std::format("{} {} {}", files.size(), total_size, newest_write.time_since_epoch().count());
+
+    if (std::ifstream stamp{stamp_file}) {
+        std::string previous_summary;
+        uint64_t previous_hash = 0;
+        const bool read = std::getline(stamp, previous_summary) && stamp >> std::hex >> previous_hash;
+        if (read && previous_summary == summary) return previous_hash;
+    }
+
+    fnv1a_hash hash;
+    for (const auto &file : files) {
+        hash.update(fs::relative(file, root).generic_string());
+        hash.update(std::string_view{"\0", 1});
+
+        std::ifstream stream{file, std::ios::binary};
+        const std::string contents{std::istreambuf_iterator<char>{stream}, {}};
+        hash.update(contents);
+    }
+
+    fs::create_directories(stamp_file.parent_path(), error);
+    std::ofstream{stamp_file} << summary << '\n' << std::hex << hash.value << '\n';
+    return hash.value;
+}
+
+// only what changes the abi, the warnings (and -Werror) of the consuming project stay out of vendored code
+[[nodiscard]] inline TALON_API auto dependency_build_options(const build_options &options) -> build_options
+{
+    build_options dependency_options{};
+    dependency_options.compiler = options.compiler;
+    dependency_options.cpp_version = options.cpp_version;
+    dependency_options.optimization = options.optimization;
+    dependency_options.sanitizer = options.sanitizer;
+    dependency_options.link_mode = options.link_mode;
+    return dependency_options;
+}
+
+[[nodiscard]] inline TALON_API auto dependency_library_name(const dependency_target &dependency, const compilers compiler) -> std::string
+{
+    return compiler == compilers::msvc ? std::format("{}.lib", dependency.name) : std::format("lib{}.a", dependency.name);
+}
+
+// compiles and archives the dependency into output with a throwaway ninja manifest, the headers are copied next to it.
+// a tree without sources is header-only and leaves no library
+inline TALON_API auto build_dependency(const dependency_target &dependency, const build_options &options, const fs::path &output) -> bool
+{
+    const auto root = fs::absolute(dependency.root);
+    const auto compiler = options.compiler;
+
+    std::vector<std::string> include_paths;
+    for (const auto &include : dependency.include_directories) {
+        include_paths.push_back((root / include).generic_string());
+    }
+
+    const std::vector<std::string_view> include_views{include_paths.begin(), include_paths.end()};
+    std::string cflags = parse_compile_flags(options);
+    cflags += cpp_version_to_statement(compiler, options.cpp_version) + ' ';
+    cflags += format_include_directories(include_views, compiler);
+    cflags += format_preprocessor_definitions(dependency.definitions);
+
+    // position independent, so shared libraries can link the same build as executables
+    if (os == platform::linux_os && compiler != compilers::msvc) cflags += " -fPIC";
+
+    // through the interface, the defaults of add_rule live there
+    ninja_builder ninja;
+    build_script_builder &builder = ninja;
+    builder.add_variable("cxx", compiler_to_statement(compiler));
+    builder.add_variable("cflags", cflags);
+
+    if (compiler == compilers::msvc) {
+        builder.add_rule("compile", "$cxx /nologo /EHsc /c $in /Fo$out $cflags", "Compiling $in");
+        builder.add_rule("archive", "lib /nologo /out:$out $in", "Archiving $out");
+    } else {
+        builder.add_variable("ar", archiver_to_statement(compiler));
+        builder.add_rule("compile", "$cxx $cflags -c $in -o $out", "Compiling $in");
+        builder.add_rule("archive", "$ar rcs $out $in", "Archiving $out");
+    }
+
+    std::string objects;
+    for (const auto &directory : dependency.source_directories) {
+        std::error_code error;
+        for (auto it = fs::recursive_directory_iterator{root / directory, error}; !error && it != fs::recursive_directory_iterator{};
+             it.increment(error)) {
+            if (!it->is_regular_file() || !is_implementation_file(it->path())) continue;
+
+            auto object = fs::path{"objects"} / fs::relative(it->path(), root);
+            object.replace_extension(compiler == compilers::msvc ? ".obj" : ".o");
+
+            builder.add_build_edge(object.generic_string(), "compile", it->path().generic_string());
+            objects += ' ' + object.generic_string();
+        }
+
+        if (error) {
+            fprintf(stderr, "[talon] error: unable to read sources of dependency %.*s: %s\n", static_cast<int>(dependency.name.size()),
+                    dependency.name.data(), error.message().c_str());
+            return false;
+        }
+    }
+
+    if (!objects.empty()) {
+        builder.add_build_edge("lib/" + dependency_library_name(dependency, compiler), "archive", objects);
+
+        fs::create_directories(output / "lib");
+        std::ofstream{output / "build.ninja"} << builder.get_script();
+
+        fflush(stdout);
+        if (std::system(std::format("ninja -C {} -f build.ninja", quote_shell_argument(output.string())).c_str()) != 0) return false;
+    }
+
+    for (const auto &include : dependency.include_directories) {
+        std::error_code error;
+        fs::copy(root / include, output / "include", fs::copy_options::recursive | fs::copy_options::overwrite_existing, error);
+        if (error) {
+            fprintf(stderr, "[talon] error: unable to copy headers of dependency %.*s: %s\n", static_cast<int>(dependency.name.size()),
+                    dependency.name.data(), error.message().c_str());
+            return false;
+        }
+    }
+
+    // only the library and the headers are worth keeping
+    std::error_code error;
+    fs::remove_all(output / "objects", error);
+    fs::remove_all(output / ".talon", error);
+    fs::remove(output / "build.ninja", error);
+    return true;
+}
+
+// an entry is complete once its configuration.txt names the library (or 'none'), and that library and the headers
+// are still there. anything short of that is left over from an interrupted cleanup, or was partly deleted by hand
+[[nodiscard]] inline TALON_API auto read_cache_entry(const fs::path &entry, const dependency_target &dependency)
+    -> std::optional<prebuilt_dependency>
+{
+    std::ifstream stream{entry / "configuration.txt"};
+    std::string line;
+    std::string library;
+    while (std::getline(stream, line)) {
+        if (line.starts_with("library ")) library = line.substr(8);
+    }
+
+    if (library.empty()) return std::nullopt;
+
+    prebuilt_dependency prebuilt{.include_directory = entry / "include", .library = {}};
+    if (library != "none") prebuilt.library = entry / "lib" / library;
+
+    std::error_code error;
+    const bool headers_present = dependency.include_directories.empty() || fs::is_directory(prebuilt.include_directory, error);
+    const bool library_present = prebuilt.library.empty() || fs::is_regular_file(prebuilt.library, error);
+    if (!headers_present || !library_present) return std::nullopt;
+
+    return prebuilt;
+}
+
+// looks the dependency up in the user cache and builds it on a miss. builds happen in a private directory that is
+// renamed into place once complete, so concurrent builds of the same configuration never see half an entry
+[[nodiscard]] inline TALON_API auto prepare_dependency(const dependency_target &dependency, const build_options &options,
+                                                       std::string_view compiler_id, const fs::path &project_cache)
+    -> std::optional<prebuilt_dependency>
+{
+    const auto cache = user_cache_directory();
+    if (!cache) {
+        fprintf(stderr, "[talon] error: no user cache directory, unable to build dependency %.*s\n",
+                static_cast<int>(dependency.name.size()), dependency.name.data());
+        return std::nullopt;
+    }
+
+    if (!fs::is_directory(dependency.root)) {
+        fprintf(stderr, "[talon] error: dependency %.*s not found at %.*s\n", static_cast<int>(dependency.name.size()),
+                dependency.name.data(), static_cast<int>(dependency.root.size()), dependency.root.data());
+        return std::nullopt;
+    }
+
+    const auto dependency_options = dependency_build_options(options);
+    const auto tree_hash = hash_dependency_tree(dependency.root, project_cache / "dependencies" / std::format("{}.txt", dependency.name));
+
+    auto configuration = std::format("name {}\ncompiler {}\ncompiler_id {}\ncpp_version {}\noptimization {}\nsanitizer {}\nlink_mode {}\n"
+                                     "tree {:016x}\n",
+                                     dependency.name, compiler_to_statement(options.compiler), compiler_id,
+                                     static_cast<int>(options.cpp_version), static_cast<int>(options.optimization),
+                                     static_cast<int>(options.sanitizer), static_cast<int>(options.link_mode), tree_hash);
+    for (const auto &definition : dependency.definitions) {
+        configuration += std::format("definition {}\n", definition);
+    }
+
+    fnv1a_hash key;
+    key.update(configuration);
+
+    const auto entry = *cache / "dependencies" / std::format("{}-{:016x}", dependency.name, key.value);
+    if (auto prebuilt = read_cache_entry(entry, dependency)) return prebuilt;
+
+    // an incomplete entry would never be replaced, the rename below fails for an existing directory
+    std::error_code error;
+    if (fs::exists(entry, error)) fs::remove_all(entry, error);
+
+    printf("[talon] building dependency %.*s, first use of this configuration\n", static_cast<int>(dependency.name.size()),
+           dependency.name.data());
+
+#ifdef _WIN32
+    const auto process_id = _getpid();
+#else
+    const auto process_id = getpid();
+#endif
+    const auto ticks = std::chrono::steady_clock::now().time_since_epoch().count();
+    const fs::path staging = std::format("{}.tmp-{}-{}", entry.string(), process_id, ticks);
+    fs::create_directories(staging, error);
+
+    if (!build_dependency(dependency, dependency_options, staging)) {
+        fs::remove_all(staging, error);
+        return std::nullopt;
+    }
+
+    const auto library = dependency_library_name(dependency, options.compiler);
+    const bool header_only = !fs::exists(staging / "lib" / library, error);
+    std::ofstream{staging / "configuration.txt"} << configuration << "library " << (header_only ? "none" : library) << '\n';
+
+    // losing the race against another build of the same configuration is fine, its entry is just as good
+    fs::rename(staging, entry, error);
+    if (error) fs::remove_all(staging, error);
+
+    auto prebuilt = read_cache_entry(entry, dependency);
+    if (!prebuilt) {
+        fprintf(stderr, "[talon] error: unable to store dependency %.*s in %s\n", static_cast<int>(dependency.name.size()),
+                dependency.name.data(), entry.string().c_str());
+    }
+
+    return prebuilt;
+}
+
+} // namespace detail
+
+} // namespace talon
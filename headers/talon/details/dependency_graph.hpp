@@ -0,0 +1,132 @@
+#pragma once
+
+#ifndef TALON_API
+#define TALON_API
+#endif
+
+#include <algorithm>
+#include <cstdlib>
+#include <filesystem>
+#include <format>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "helpers.hpp"
+
+namespace talon {
+
+namespace detail {
+
+// maps every output in ninja's deps log to the inputs recorded for it, the source file itself plus every header
+// the compiler reported through the depfile
+using dependency_log = std::unordered_map<std::string, std::vector<std::string>>;
+
+struct compile_edge {
+    std::string object;
+    std::string source;
+
+    auto operator==(const compile_edge &) const -> bool = default;
+};
+
+[[nodiscard]] inline TALON_API auto normalize_graph_path(std::string_view path) -> std::string
+{
+    return fs::path{path}.lexically_normal().generic_string();
+}
+
+// parses the output of 'ninja -t deps', which looks like:
+//   build/objects/src/main.o: #deps 2, deps mtime 1718000000 (VALID)
+//       src/main.cc
+//       src/main.hpp
+// stale entries are left out, their output is out of date and has to be rebuilt anyway
+[[nodiscard]] inline TALON_API auto parse_dependency_log(std::string_view text) -> dependency_log
+{
+    dependency_log log;
+    std::vector<std::string> *current_entry = nullptr;
+
+    while (!text.empty()) {
+        const auto line_end = text.find('\n');
+        auto line = text.substr(0, line_end);
+        text = line_end == std::string_view::npos ? std::string_view{} : text.substr(line_end + 1);
+
+        if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+        if (line.empty()) {
+            current_entry = nullptr;
+            continue;
+        }
+
+        const bool is_input = line.front() == ' ' || line.front() == '\t';
+        if (is_input) {
+            const auto first = line.find_first_not_of(" \t");
+            if (current_entry && first != std::string_view::npos) current_entry->push_back(normalize_graph_path(line.substr(first)));
+            continue;
+        }
+
+        const auto separator = line.find(": #deps");
+        if (separator == std::string_view::npos || line.ends_with("(STALE)")) {
+            current_entry = nullptr;
+            continue;
+        }
+
+        current_entry = &log[normalize_graph_path(line.substr(0, separator))];
+    }
+
+    return log;
+}
+
+[[nodiscard]] inline TALON_API auto load_dependency_log(std::string_view manifest) -> std::optional<dependency_log>
+{
+    const auto output = capture_command_output(std::format("ninja -f {} -t deps", manifest));
+    if (!output) return std::nullopt;
+
+    return parse_dependency_log(*output);
+}
+
+// the talon driver hands the changed files of 'talon build --affected' over as a newline separated list
+[[nodiscard]] inline TALON_API auto changed_files_from_environment() -> std::optional<std::vector<std::string>>
+{
+    const char *value = std::getenv("TALON_AFFECTED_FILES");
+    if (value == nullptr) return std::nullopt;
+
+    std::vector<std::string> changed_files;
+    std::string_view remaining{value};
+    while (!remaining.empty()) {
+        const auto line_end = remaining.find('\n');
+        const auto line = remaining.substr(0, line_end);
+        if (!line.empty()) changed_files.push_back(normalize_graph_path(line));
+
+        if (line_end == std::string_view::npos) break;
+        remaining.remove_prefix(line_end + 1);
+    }
+
+    return changed_files;
+}
+
+// an object is affected when its source or any header it was built against changed, objects without a deps log
+// entry were never built (or are stale) and are always affected
+[[nodiscard]] inline TALON_API auto find_affected_objects(const std::vector<compile_edge> &edges, const dependency_log &log,
+                                                          const std::vector<std::string> &changed_files) -> std::vector<std::string>
+{
+    const std::unordered_set<std::string> changed{changed_files.begin(), changed_files.end()};
+
+    std::vector<std::string> affected;
+    for (const auto &edge : edges) {
+        const auto entry = log.find(normalize_graph_path(edge.object));
+        const bool never_built = entry == log.end();
+
+        const bool source_changed = changed.contains(normalize_graph_path(edge.source));
+        const bool header_changed =
+            !never_built && std::ranges::any_of(entry->second, [&](const std::string &input) { return changed.contains(input); });
+
+        if (never_built || source_changed || header_changed) affected.push_back(edge.object);
+    }
+
+    return affected;
+}
+
+} // namespace detail
+
+} // namespace talon
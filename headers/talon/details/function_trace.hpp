@@ -0,0 +1,142 @@
+#pragma once
+
+#include <string_view>
+
+namespace talon {
+
+namespace detail {
+
+// the runtime behind instrumentation_mode::functions, written to .talon/ and linked into the instrumented binary.
+// it avoids the standard library on purpose, anything inline from it would be instrumented and call back into
+// the hooks. the trace is read by 'talon profile', the layout is:
+//   "TALONFT1", u64 load address of the executable, then records of u64 nanoseconds, u64 function address,
+//   u32 thread id, u32 kind (0 enter, 1 exit), everything little endian
+inline constexpr std::string_view function_trace_runtime = R"runtime(// generated by talon for instrumentation_mode::functions, do not edit
+#include <link.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TALON_NO_INSTRUMENT __attribute__((no_instrument_function))
+
+// declared up front, the runtime is compiled with the project's warnings (-Wmissing-declarations and friends)
+extern "C" void __cyg_profile_func_enter(void *function, void *call_site);
+extern "C" void __cyg_profile_func_exit(void *function, void *call_site);
+
+namespace {
+
+struct trace_record {
+    uint64_t nanoseconds;
+    uint64_t function;
+    uint32_t thread;
+    uint32_t kind;
+};
+
+constexpr size_t buffer_capacity = 2048;
+
+FILE *trace_file = nullptr;
+pthread_mutex_t trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// plain data on purpose, a constructor or destructor would give the thread_local a compiler generated wrapper, which
+// gets instrumented and recurses into the hooks. thread_local storage starts out zeroed, and buffers of exiting
+// threads are flushed through the destructor of a pthread key instead
+struct thread_buffer {
+    trace_record records[buffer_capacity];
+    size_t count;
+    uint32_t thread;
+    bool in_hook;
+    bool registered;
+};
+
+thread_local thread_buffer buffer;
+pthread_key_t flush_key;
+
+TALON_NO_INSTRUMENT void flush(thread_buffer *target)
+{
+    if (target->count == 0) return;
+
+    pthread_mutex_lock(&trace_mutex);
+    if (trace_file != nullptr) fwrite(target->records, sizeof(trace_record), target->count, trace_file);
+    pthread_mutex_unlock(&trace_mutex);
+    target->count = 0;
+}
+
+TALON_NO_INSTRUMENT void flush_exiting_thread(void *target)
+{
+    flush(static_cast<thread_buffer *>(target));
+}
+
+TALON_NO_INSTRUMENT int find_executable(dl_phdr_info *info, size_t, void *load_address)
+{
+    // the first object reported is the executable itself
+    *static_cast<uint64_t *>(load_address) = info->dlpi_addr;
+    return 1;
+}
+
+TALON_NO_INSTRUMENT void record(void *function, uint32_t kind)
+{
+    if (buffer.in_hook || trace_file == nullptr) return;
+    buffer.in_hook = true;
+
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    if (!buffer.registered) {
+        buffer.registered = true;
+        buffer.thread = static_cast<uint32_t>(syscall(SYS_gettid));
+        pthread_setspecific(flush_key, &buffer);
+    }
+
+    buffer.records[buffer.count++] = {static_cast<uint64_t>(now.tv_sec) * 1000000000u + static_cast<uint64_t>(now.tv_nsec),
+                                      reinterpret_cast<uint64_t>(function), buffer.thread, kind};
+    if (buffer.count == buffer_capacity) flush(&buffer);
+
+    buffer.in_hook = false;
+}
+
+TALON_NO_INSTRUMENT __attribute__((constructor(101))) void open_trace()
+{
+    pthread_key_create(&flush_key, flush_exiting_thread);
+
+    const char *path = getenv("TALON_TRACE_FILE");
+    trace_file = fopen(path != nullptr ? path : "function-trace.bin", "wb");
+    if (trace_file == nullptr) return;
+
+    uint64_t load_address = 0;
+    dl_iterate_phdr(find_executable, &load_address);
+
+    fwrite("TALONFT1", 1, 8, trace_file);
+    fwrite(&load_address, sizeof(load_address), 1, trace_file);
+}
+
+TALON_NO_INSTRUMENT __attribute__((destructor(101))) void close_trace()
+{
+    flush(&buffer);
+
+    pthread_mutex_lock(&trace_mutex);
+    if (trace_file != nullptr) fclose(trace_file);
+    trace_file = nullptr;
+    pthread_mutex_unlock(&trace_mutex);
+}
+
+} // namespace
+
+extern "C" TALON_NO_INSTRUMENT void __cyg_profile_func_enter(void *function, void *)
+{
+    record(function, 0);
+}
+
+extern "C" TALON_NO_INSTRUMENT void __cyg_profile_func_exit(void *function, void *)
+{
+    record(function, 1);
+}
+)runtime";
+
+} // namespace detail
+
+} // namespace talon
@@ -6,10 +6,17 @@
 
 #include <algorithm>
 #include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
 #include <filesystem>
+#include <format>
 #include <optional>
 #include <print>
+#include <ranges>
+#include <string>
 #include <string_view>
+#include <system_error>
 #include <vector>
 
 #include "build_options.hpp"
@@ -23,16 +30,28 @@ namespace detail {
 using compile_option = build_options::compile_option;
 using compile_section = build_options::compile_section;
 
-inline TALON_API auto parse_compile_flags(const build_options &opts) -> std::string
+// renders every enabled option belonging to the given section, the option set is resolved at compile time
+template <compile_section Section>
+[[nodiscard]] constexpr auto render_option_flags(const build_options &opts) -> std::string
 {
     std::string flag_buffer{};
     opts.visit_options([&](const compile_option &option) -> void {
-        if (option.enabled && (option.section == compile_section::build || option.section == compile_section::both)) {
-            flag_buffer += opts.compiler == compilers::msvc ? option.msvc_flag : option.clang_flag;
-            flag_buffer += ' ';
-        }
+        if (!option.enabled || (option.section != Section && option.section != compile_section::both)) return;
+
+        const auto flag = option.flag_for(opts.compiler);
+        if (flag.empty()) return;
+
+        flag_buffer += flag;
+        flag_buffer += ' ';
     });
 
+    return flag_buffer;
+}
+
+inline TALON_API auto parse_compile_flags(const build_options &opts) -> std::string
+{
+    std::string flag_buffer = render_option_flags<compile_section::build>(opts);
+
     switch (opts.link_mode) {
     case link_mode::statically: {
         flag_buffer += "-static ";
@@ -80,6 +99,41 @@ inline TALON_API auto parse_compile_flags(const build_options &opts) -> std::str
     }
     }
 
+    switch (opts.instrumentation) {
+    case instrumentation_mode::none: {
+        break;
+    }
+
+    case instrumentation_mode::xray: {
+        flag_buffer += std::format("-fxray-instrument -fxray-instruction-threshold={} ", opts.xray_instruction_threshold);
+        if (!opts.xray_always_instrument.empty()) flag_buffer += std::format("-fxray-always-instrument={} ", opts.xray_always_instrument);
+        if (!opts.xray_never_instrument.empty()) flag_buffer += std::format("-fxray-never-instrument={} ", opts.xray_never_instrument);
+        break;
+    }
+
+    case instrumentation_mode::functions: {
+        flag_buffer += "-finstrument-functions ";
+        break;
+    }
+    }
+
+    if (opts.runtime_performance) {
+        switch (opts.compiler) {
+        case compilers::gcc:
+        case compilers::clang: {
+            flag_buffer += "-ffunction-sections -fdata-sections ";
+            // plt and interposition only exist for elf, mach-o binds lazily through its own stubs
+            if constexpr (os == platform::linux_os) flag_buffer += "-fno-plt -fno-semantic-interposition ";
+            break;
+        }
+
+        case compilers::msvc: {
+            flag_buffer += "/Gy /Gw "; // function level linking and per variable sections, used by /OPT:REF
+            break;
+        }
+        }
+    }
+
     switch (opts.optimization) {
     case optimize_level::debug: {
         flag_buffer += opts.compiler == compilers::msvc ? "/Od " : "-Og ";
@@ -107,13 +161,41 @@ inline TALON_API auto parse_compile_flags(const build_options &opts) -> std::str
 
 inline TALON_API auto parse_link_flags(const build_options &opts) -> std::string
 {
-    std::string flag_buffer;
-    opts.visit_options([&](const compile_option &option) -> void {
-        if (option.enabled && (option.section == compile_section::link || option.section == compile_section::both)) {
-            flag_buffer += opts.compiler == compilers::msvc ? option.msvc_flag : option.clang_flag;
-            flag_buffer += ' ';
+    std::string flag_buffer = render_option_flags<compile_section::link>(opts);
+
+    // whole archive, nothing in the build references the allocator directly so the linker would skip its objects
+    if (!opts.allocator_library.empty()) {
+        if (opts.compiler == compilers::msvc) {
+            flag_buffer += std::format("/WHOLEARCHIVE:\"{}\" ", opts.allocator_library);
+        } else if constexpr (os == platform::mac_os) {
+            flag_buffer += std::format("-Wl,-force_load,\"{}\" ", opts.allocator_library);
+        } else {
+            flag_buffer += std::format("-Wl,--whole-archive \"{}\" -Wl,--no-whole-archive ", opts.allocator_library);
         }
-    });
+    }
+
+    if (opts.runtime_performance) {
+        switch (opts.compiler) {
+        case compilers::gcc:
+        case compilers::clang: {
+            if constexpr (os == platform::linux_os) {
+                flag_buffer += "-Wl,-O1,--gc-sections,-z,now ";
+                flag_buffer += "-Wl,-z,common-page-size=2097152,-z,max-page-size=2097152 ";
+            } else if constexpr (os == platform::mac_os) {
+                flag_buffer += "-Wl,-dead_strip ";
+            }
+            break;
+        }
+
+        case compilers::msvc: {
+            flag_buffer += "/OPT:REF /OPT:ICF ";
+            break;
+        }
+        }
+    }
+
+    // pulls in the xray runtime, the -finstrument-functions runtime is an object of the build itself
+    if (opts.instrumentation == instrumentation_mode::xray) flag_buffer += "-fxray-instrument ";
 
     return flag_buffer;
 }
@@ -137,14 +219,105 @@ inline TALON_API constexpr auto compiler_to_statement(const compilers compiler)
     return "";
 }
 
+// one argument for std::system, whatever spaces or shell metacharacters it contains. cmd.exe has no single quotes,
+// double quotes are the best it gets
+inline TALON_API auto quote_shell_argument(std::string_view argument) -> std::string
+{
+    if constexpr (os == platform::windows_os) return std::format("\"{}\"", argument);
+
+    std::string quoted = "'";
+    for (const auto character : argument) {
+        if (character == '\'') {
+            quoted += "'\\''";
+        } else {
+            quoted += character;
+        }
+    }
+
+    return quoted + '\'';
+}
+
+// runs a shell command and returns everything it wrote to stdout, or nothing if it could not run or failed
+inline TALON_API auto capture_command_output(const std::string &command) -> std::optional<std::string>
+{
+#ifdef _WIN32
+    FILE *pipe = _popen(command.c_str(), "r");
+#else
+    FILE *pipe = popen(command.c_str(), "r");
+#endif
+    if (pipe == nullptr) return std::nullopt;
+
+    std::string output;
+    std::array<char, 4096> buffer{};
+    while (const auto read = std::fread(buffer.data(), 1, buffer.size(), pipe)) {
+        output.append(buffer.data(), read);
+    }
+
+#ifdef _WIN32
+    const int status = _pclose(pipe);
+#else
+    const int status = pclose(pipe);
+#endif
+    if (status != 0) return std::nullopt;
+
+    return output;
+}
+
+// where the shell would find program, in PATH order
+[[nodiscard]] inline TALON_API auto find_in_path(std::string_view program) -> std::optional<fs::path>
+{
+    const char *path = std::getenv("PATH");
+    if (path == nullptr) return std::nullopt;
+
+    constexpr char separator = os == platform::windows_os ? ';' : ':';
+    const auto executable = std::format("{}{}", program, os == platform::windows_os ? ".exe" : "");
+    for (const auto directory : std::string_view{path} | std::views::split(separator)) {
+        if (directory.empty()) continue;
+
+        const auto candidate = fs::path{std::string_view{directory.begin(), directory.end()}} / executable;
+        std::error_code error;
+        if (fs::is_regular_file(candidate, error)) return candidate;
+    }
+
+    return std::nullopt;
+}
+
+// llvm-ar when clang ships with one, the system ar is not guaranteed to understand thin archives (macos). looked up
+// rather than run, every builder start goes through here
+inline TALON_API auto archiver_to_statement(const compilers compiler) -> std::string_view
+{
+    if (compiler == compilers::clang && find_in_path("llvm-ar")) return "llvm-ar";
+    return "ar";
+}
+
+// appends 'builder.<phase><tab>microseconds' to the file named by TALON_TIMINGS, the driver writes its own phases
+// there too. read by the benchmark suite in benchmark/, a no-op without the variable
+inline TALON_API auto record_phase_time(std::string_view phase, std::chrono::steady_clock::time_point started) -> void
+{
+    const char *path = std::getenv("TALON_TIMINGS");
+    if (path == nullptr) return;
+
+    const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - started);
+    if (FILE *timings = std::fopen(path, "a")) {
+        std::fprintf(timings, "builder.%.*s\t%lld\n", static_cast<int>(phase.size()), phase.data(),
+                     static_cast<long long>(elapsed.count()));
+        std::fclose(timings);
+    }
+}
+
+// what source discovery compiles, headers and everything else are left alone
+inline TALON_API auto is_implementation_file(const fs::path &path) -> bool
+{
+    static constexpr std::array implementation_extensions{".cc", ".cxx", ".cpp"};
+    return std::ranges::contains(implementation_extensions, path.extension().string());
+}
+
 inline TALON_API auto find_and_collect_files(const fs::path &directory, const std::vector<std::string_view> &includes)
     -> std::vector<fs::path>
 {
     const auto root = fs::path{directory / "src/"};
     if (!fs::exists(root) || !fs::is_directory(root)) { return {}; }
 
-    static constexpr std::array target_extensions{".cc", ".cxx", ".cpp"};
-
     std::vector<fs::path> found_impl_files;
     found_impl_files.reserve(25000);
 
@@ -153,9 +326,7 @@ inline TALON_API auto find_and_collect_files(const fs::path &directory, const st
             for (const auto &entry : fs::recursive_directory_iterator{target}) {
                 if (!entry.is_regular_file()) continue;
 
-                const auto &path = entry.path();
-                const auto extension = path.extension().string();
-                if (std::ranges::contains(target_extensions, extension)) {
+                if (is_implementation_file(entry.path())) {
                     const auto file_name_with_relative_path = fs::relative(entry.path(), directory);
                     found_impl_files.push_back(std::move(file_name_with_relative_path));
                 }
@@ -246,13 +417,13 @@ inline TALON_API auto format_output_type_flags(output_mode output_type, compiler
     if (compiler == compilers::msvc) {
         switch (output_type) {
         case output_mode::executable: return "";
-        case output_mode::static_library: return " /c";
+        case output_mode::static_library: return ""; // objects get archived by lib.exe
         case output_mode::dynamic_library: return " /LD";
         }
     } else { // clang
         switch (output_type) {
         case output_mode::executable: return "";
-        case output_mode::static_library: return " -c";
+        case output_mode::static_library: return ""; // objects get archived by ar
         case output_mode::dynamic_library: return std::string{" -shared"} + (os == platform::linux_os ? " -fPIC" : "");
         }
     }
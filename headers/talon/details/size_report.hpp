@@ -0,0 +1,397 @@
+#pragma once
+
+#ifndef TALON_API
+#define TALON_API
+#endif
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#if defined(__linux__)
+#include <elf.h>
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#include <cxxabi.h>
+#endif
+
+#include "helpers.hpp"
+
+namespace talon {
+
+namespace detail {
+
+struct elf_section {
+    std::string name;
+    uint64_t size = 0;
+    bool allocated = false;  // takes up memory at runtime
+    bool executable = false; // lives in the i-cache
+    bool no_bits = false;    // .bss and friends, no bytes in the file
+};
+
+struct elf_symbol {
+    std::string name;
+    uint64_t size = 0;
+    uint16_t section = 0;
+    std::string file; // the STT_FILE preceding a local symbol, empty for globals
+};
+
+struct elf_file {
+    std::vector<elf_section> sections;
+    std::vector<elf_symbol> symbols; // defined functions and objects only
+};
+
+[[nodiscard]] inline TALON_API auto demangle_symbol(const std::string &name) -> std::string
+{
+#if defined(__GNUC__) || defined(__clang__)
+    int status = 0;
+    const std::unique_ptr<char, decltype(&std::free)> demangled{abi::__cxa_demangle(name.c_str(), nullptr, nullptr, &status),
+                                                                &std::free};
+    if (status == 0 && demangled) return demangled.get();
+#endif
+    return name;
+}
+
+#if defined(__linux__)
+
+// reads section headers and .symtab straight out of the file, only 64-bit little endian ELF is understood
+[[nodiscard]] inline TALON_API auto read_elf_file(const fs::path &path) -> std::optional<elf_file>
+{
+    std::ifstream stream{path, std::ios::binary};
+    if (!stream) return std::nullopt;
+
+    const std::vector<char> data{std::istreambuf_iterator<char>{stream}, {}};
+    const auto read = [&]<typename T>(T &value, const uint64_t offset) {
+        if (offset > data.size() || data.size() - offset < sizeof(T)) return false;
+        std::memcpy(&value, data.data() + offset, sizeof(T));
+        return true;
+    };
+
+    Elf64_Ehdr header{};
+    if (!read(header, 0) || std::memcmp(header.e_ident, ELFMAG, SELFMAG) != 0) return std::nullopt;
+    if (header.e_ident[EI_CLASS] != ELFCLASS64 || header.e_ident[EI_DATA] != ELFDATA2LSB) return std::nullopt;
+
+    std::vector<Elf64_Shdr> section_headers(header.e_shnum);
+    for (uint16_t i = 0; i < header.e_shnum; ++i) {
+        if (!read(section_headers[i], header.e_shoff + uint64_t{i} * header.e_shentsize)) return std::nullopt;
+    }
+
+    const auto string_at = [&](const Elf64_Shdr &table, const uint64_t offset) -> std::string {
+        if (table.sh_offset + offset >= data.size()) return {};
+        const char *begin = data.data() + table.sh_offset + offset;
+        return {begin, strnlen(begin, data.size() - table.sh_offset - offset)};
+    };
+
+    elf_file file;
+    for (const auto &section : section_headers) {
+        const auto name = header.e_shstrndx < section_headers.size() ? string_at(section_headers[header.e_shstrndx], section.sh_name)
+                                                                    : std::string{};
+        file.sections.push_back({.name = name,
+                                 .size = section.sh_size,
+                                 .allocated = (section.sh_flags & SHF_ALLOC) != 0,
+                                 .executable = (section.sh_flags & SHF_EXECINSTR) != 0,
+                                 .no_bits = section.sh_type == SHT_NOBITS});
+    }
+
+    for (const auto &section : section_headers) {
+        if (section.sh_type != SHT_SYMTAB || section.sh_link >= section_headers.size()) continue;
+
+        const auto &strings = section_headers[section.sh_link];
+        const auto count = section.sh_entsize == 0 ? 0 : section.sh_size / section.sh_entsize;
+
+        std::string current_file;
+        for (uint64_t i = 0; i < count; ++i) {
+            Elf64_Sym symbol{};
+            if (!read(symbol, section.sh_offset + i * section.sh_entsize)) break;
+
+            const auto type = ELF64_ST_TYPE(symbol.st_info);
+            if (type == STT_FILE) {
+                current_file = string_at(strings, symbol.st_name);
+                continue;
+            }
+
+            const bool defined = symbol.st_shndx != SHN_UNDEF && symbol.st_shndx < SHN_LORESERVE;
+            if (!defined || symbol.st_size == 0 || (type != STT_FUNC && type != STT_OBJECT)) continue;
+
+            const bool local = ELF64_ST_BIND(symbol.st_info) == STB_LOCAL;
+            file.symbols.push_back({.name = string_at(strings, symbol.st_name),
+                                    .size = symbol.st_size,
+                                    .section = symbol.st_shndx,
+                                    .file = local ? current_file : std::string{}});
+        }
+    }
+
+    return file;
+}
+
+#endif
+
+// the outermost namespace (or class) of a demangled name, template arguments and parameters are skipped so
+// 'std::vector<foo::bar>::push_back(foo::bar const&)' lands in 'std'
+[[nodiscard]] inline TALON_API auto symbol_namespace(std::string_view demangled) -> std::string
+{
+    // 'vtable for foo::bar', 'non-virtual thunk to foo::bar::baz()'
+    for (const std::string_view prefix : {" for ", " to "}) {
+        const auto position = demangled.find(prefix);
+        if (position != std::string_view::npos && position < demangled.find_first_of("<(")) {
+            demangled.remove_prefix(position + prefix.size());
+        }
+    }
+
+    static constexpr std::string_view anonymous = "(anonymous namespace)";
+    if (demangled.starts_with(anonymous)) return std::string{anonymous};
+
+    int depth = 0;
+    for (size_t i = 0; i < demangled.size(); ++i) {
+        const char character = demangled[i];
+        if (depth == 0 && (character == '(' || character == ' ')) break; // parameters, or a return type 'void foo<int>()'
+        if (character == '<') ++depth;
+        if (character == '>') --depth;
+
+        if (depth == 0 && demangled.substr(i).starts_with("::")) return std::string{demangled.substr(0, i)};
+    }
+
+    return "(global)";
+}
+
+// a demangled name with every template argument list emptied and the parameters dropped, all instantiations of
+// one template collapse into the same key
+[[nodiscard]] inline TALON_API auto template_key(std::string_view demangled) -> std::optional<std::string>
+{
+    std::string key;
+    int template_depth = 0;
+    bool is_template = false;
+
+    static constexpr std::string_view anonymous = "(anonymous namespace)";
+    if (demangled.starts_with(anonymous)) {
+        key = anonymous;
+        demangled.remove_prefix(anonymous.size());
+    }
+
+    for (const char character : demangled) {
+        if (character == '(' && template_depth == 0) break;
+
+        if (character == '<') {
+            if (template_depth++ == 0) key += "<>";
+            is_template = true;
+            continue;
+        }
+
+        if (character == '>') {
+            --template_depth;
+            continue;
+        }
+
+        if (template_depth == 0) key += character;
+    }
+
+    if (!is_template) return std::nullopt;
+    return key;
+}
+
+// standard library instantiations easily demangle to a screen full of text, those are shown with their template
+// arguments left out
+[[nodiscard]] inline TALON_API auto display_symbol_name(const std::string &demangled) -> std::string
+{
+    static constexpr size_t max_length = 120;
+    if (demangled.size() <= max_length) return demangled;
+
+    const auto key = template_key(demangled);
+    return key && key->size() <= max_length ? *key + "(...)" : demangled.substr(0, max_length) + "...";
+}
+
+struct size_snapshot {
+    std::map<std::string, uint64_t> sections;
+    std::unordered_map<std::string, uint64_t> symbols; // mangled name to size
+};
+
+[[nodiscard]] inline TALON_API auto load_size_snapshot(const fs::path &path) -> std::optional<size_snapshot>
+{
+    std::ifstream stream{path};
+    if (!stream) return std::nullopt;
+
+    size_snapshot snapshot;
+    std::string kind, name;
+    uint64_t size = 0;
+    while (std::getline(stream, kind, '\t') && stream >> size && stream.get() == '\t' && std::getline(stream, name)) {
+        if (kind == "section") snapshot.sections[name] = size;
+        if (kind == "symbol") snapshot.symbols[name] += size;
+    }
+
+    return snapshot;
+}
+
+inline TALON_API auto write_size_snapshot(const fs::path &path, const size_snapshot &snapshot) -> void
+{
+    std::ofstream stream{path};
+    for (const auto &[name, size] : snapshot.sections) {
+        stream << "section\t" << size << '\t' << name << '\n';
+    }
+
+    for (const auto &[name, size] : snapshot.symbols) {
+        stream << "symbol\t" << size << '\t' << name << '\n';
+    }
+}
+
+inline TALON_API auto print_size_table(const char *title, std::vector<std::pair<std::string, uint64_t>> rows, const size_t limit)
+    -> void
+{
+    std::ranges::sort(rows, [](const auto &a, const auto &b) { return a.second > b.second; });
+
+    printf("\n%s\n", title);
+    for (size_t i = 0; i < rows.size() && i < limit; ++i) {
+        printf("  %10llu  %s\n", static_cast<unsigned long long>(rows[i].second), rows[i].first.c_str());
+    }
+
+    if (rows.size() > limit) printf("  %10s  ... %zu more\n", "", rows.size() - limit);
+}
+
+inline TALON_API auto print_size_diff(const size_snapshot &previous, const size_snapshot &current, const size_t limit) -> void
+{
+    const auto signed_delta = [](const uint64_t before, const uint64_t after) {
+        return static_cast<long long>(after) - static_cast<long long>(before);
+    };
+
+    printf("\nchanges since the previous 'talon size'\n");
+    for (const auto &[name, size] : current.sections) {
+        const auto before = previous.sections.contains(name) ? previous.sections.at(name) : 0;
+        if (before != size) printf("  %+10lld  section %s\n", signed_delta(before, size), name.c_str());
+    }
+
+    std::vector<std::pair<std::string, long long>> deltas;
+    for (const auto &[name, size] : current.symbols) {
+        const auto before = previous.symbols.find(name);
+        const auto delta = signed_delta(before == previous.symbols.end() ? 0 : before->second, size);
+        if (delta != 0) deltas.emplace_back(name, delta);
+    }
+
+    for (const auto &[name, size] : previous.symbols) {
+        if (!current.symbols.contains(name)) deltas.emplace_back(name, -static_cast<long long>(size));
+    }
+
+    if (deltas.empty()) {
+        printf("  no symbol changed size\n");
+        return;
+    }
+
+    std::ranges::sort(deltas, [](const auto &a, const auto &b) { return std::abs(a.second) > std::abs(b.second); });
+    for (size_t i = 0; i < deltas.size() && i < limit; ++i) {
+        printf("  %+10lld  %s\n", deltas[i].second, display_symbol_name(demangle_symbol(deltas[i].first)).c_str());
+    }
+}
+
+// breaks the linked binary down by section, translation unit, namespace and template, symbols are attributed to
+// the first object defining them, inline functions and templates emitted by several objects only count once
+// (the linker kept a single copy) but their duplication is reported, it still costs compile time
+[[nodiscard]] inline TALON_API auto print_size_report(const fs::path &binary, const std::vector<std::string> &objects,
+                                                      const fs::path &snapshot_path, const size_t limit) -> bool
+{
+#if defined(__linux__)
+    const auto file = read_elf_file(binary);
+    if (!file) {
+        fprintf(stderr, "[talon] error: '%s' is not a 64-bit little endian ELF file\n", binary.string().c_str());
+        return false;
+    }
+
+    size_snapshot snapshot;
+    std::vector<std::pair<std::string, uint64_t>> section_rows;
+    uint64_t executable_bytes = 0, allocated_bytes = 0;
+    for (const auto &section : file->sections) {
+        if (!section.allocated || section.size == 0) continue;
+
+        section_rows.emplace_back(section.name, section.size);
+        snapshot.sections[section.name] = section.size;
+        allocated_bytes += section.no_bits ? 0 : section.size;
+        if (section.executable) executable_bytes += section.size;
+    }
+
+    // which objects define a symbol, locals are keyed on their file as well so equally named statics stay apart
+    std::unordered_map<std::string, std::vector<std::string>> definitions;
+    for (const auto &object : objects) {
+        const auto object_file = read_elf_file(object);
+        if (!object_file) continue;
+
+        for (const auto &symbol : object_file->symbols) {
+            definitions[symbol.file + '\t' + symbol.name].push_back(object);
+        }
+    }
+
+    std::unordered_map<std::string, uint64_t> by_object, by_namespace, by_template, by_template_count;
+    std::vector<std::pair<std::string, uint64_t>> largest_functions, duplicated;
+    for (const auto &symbol : file->symbols) {
+        snapshot.symbols[symbol.name] += symbol.size;
+
+        const auto demangled = demangle_symbol(symbol.name);
+        by_namespace[symbol_namespace(demangled)] += symbol.size;
+
+        if (const auto key = template_key(demangled)) {
+            by_template[*key] += symbol.size;
+            ++by_template_count[*key];
+        }
+
+        const bool executable = symbol.section < file->sections.size() && file->sections[symbol.section].executable;
+        if (executable) largest_functions.emplace_back(display_symbol_name(demangled), symbol.size);
+
+        // the linker keeps the STT_FILE entries of every object, so locals find their own object again
+        auto definition = definitions.find(symbol.file + '\t' + symbol.name);
+        if (definition == definitions.end()) definition = definitions.find("\t" + symbol.name);
+
+        if (definition == definitions.end()) {
+            by_object["(outside of the project objects)"] += symbol.size;
+            continue;
+        }
+
+        by_object[definition->second.front()] += symbol.size;
+        if (definition->second.size() > 1) {
+            const auto name = std::format("{} (in {} objects)", display_symbol_name(demangled), definition->second.size());
+            duplicated.emplace_back(name, symbol.size);
+        }
+    }
+
+    std::vector<std::pair<std::string, uint64_t>> template_rows;
+    for (const auto &[key, size] : by_template) {
+        template_rows.emplace_back(std::format("{} x{}", key, by_template_count[key]), size);
+    }
+
+    printf("[talon] size of %s: %llu bytes loaded, %llu bytes of code\n", binary.string().c_str(),
+           static_cast<unsigned long long>(allocated_bytes), static_cast<unsigned long long>(executable_bytes));
+
+    print_size_table("by section", std::move(section_rows), limit);
+    print_size_table("by translation unit", {by_object.begin(), by_object.end()}, limit);
+    print_size_table("by namespace", {by_namespace.begin(), by_namespace.end()}, limit);
+    print_size_table("by template", std::move(template_rows), limit);
+    print_size_table("largest functions", std::move(largest_functions), limit);
+    if (!duplicated.empty()) print_size_table("emitted by several translation units", std::move(duplicated), limit);
+
+    if (const auto previous = load_size_snapshot(snapshot_path)) print_size_diff(*previous, snapshot, limit);
+    write_size_snapshot(snapshot_path, snapshot);
+
+    return true;
+#else
+    (void)binary;
+    (void)objects;
+    (void)snapshot_path;
+    (void)limit;
+    fprintf(stderr, "[talon] error: size analysis is only supported for ELF binaries on linux\n");
+    return false;
+#endif
+}
+
+} // namespace detail
+
+} // namespace talon
@@ -0,0 +1,161 @@
+#pragma once
+
+#ifndef TALON_API
+#define TALON_API
+#endif
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <filesystem>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__linux__)
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+#include "dependency_graph.hpp"
+
+namespace talon {
+
+namespace detail {
+
+// the builder exits with this code when build.cc changes during 'talon watch', the driver then recompiles it
+inline constexpr int watch_restart_exit_code = 3;
+
+struct watch_changes {
+    std::vector<std::string> files; // relative to the workspace root
+    bool structural = false;        // something was created, removed or renamed, the sources have to be rescanned
+};
+
+#if defined(__linux__)
+
+struct file_watcher {
+    // the root itself is watched without recursion, that is enough to notice build.cc changing
+    file_watcher(fs::path root, const std::vector<fs::path> &recursive_directories)
+        : root_{std::move(root)}
+        , descriptor_{inotify_init1(IN_CLOEXEC)}
+    {
+        if (descriptor_ < 0) return;
+
+        add_watch(root_);
+        for (const auto &directory : recursive_directories) {
+            add_recursive_watch((root_ / directory).lexically_normal());
+        }
+    }
+
+    ~file_watcher()
+    {
+        if (descriptor_ >= 0) close(descriptor_);
+    }
+
+    file_watcher(const file_watcher &) = delete;
+    auto operator=(const file_watcher &) -> file_watcher & = delete;
+
+    [[nodiscard]] auto valid() const noexcept -> bool
+    {
+        return descriptor_ >= 0;
+    }
+
+    // blocks until something changes, then keeps collecting until it was quiet for the debounce window, editors
+    // tend to save a file as several writes or as a write to a temporary followed by a rename
+    [[nodiscard]] auto wait_for_changes(const std::chrono::milliseconds debounce) -> watch_changes
+    {
+        watch_changes changes;
+        while (!read_events(-1, changes)) {}
+        while (read_events(static_cast<int>(debounce.count()), changes)) {}
+
+        std::ranges::sort(changes.files);
+        const auto duplicates = std::ranges::unique(changes.files);
+        changes.files.erase(duplicates.begin(), duplicates.end());
+
+        return changes;
+    }
+
+  private:
+    static constexpr uint32_t watch_mask = IN_CLOSE_WRITE | IN_MODIFY | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO;
+
+    auto add_watch(const fs::path &directory) -> void
+    {
+        const int watch = inotify_add_watch(descriptor_, directory.c_str(), watch_mask);
+        if (watch >= 0) directories_[watch] = directory;
+    }
+
+    auto add_recursive_watch(const fs::path &directory) -> void
+    {
+        std::error_code error;
+        if (!fs::is_directory(directory, error) || is_ignored(directory)) return;
+
+        add_watch(directory);
+        for (auto it = fs::recursive_directory_iterator{directory, error}; !error && it != fs::recursive_directory_iterator{};
+             it.increment(error)) {
+            if (!it->is_directory(error)) continue;
+
+            if (is_ignored(it->path())) {
+                it.disable_recursion_pending();
+                continue;
+            }
+
+            add_watch(it->path());
+        }
+    }
+
+    // talon writes its outputs while we are watching, reacting to those would rebuild forever
+    [[nodiscard]] auto is_ignored(const fs::path &path) const -> bool
+    {
+        const auto relative = path.lexically_relative(root_);
+        if (relative.empty()) return false;
+
+        const auto &first = *relative.begin();
+        return first == "build" || first == ".talon" || first == ".git";
+    }
+
+    // returns false when nothing arrived before the timeout
+    auto read_events(const int timeout_ms, watch_changes &changes) -> bool
+    {
+        pollfd poll_descriptor{.fd = descriptor_, .events = POLLIN, .revents = 0};
+        if (poll(&poll_descriptor, 1, timeout_ms) <= 0) return false;
+
+        alignas(inotify_event) std::array<char, 16 * 1024> buffer;
+        const auto length = read(descriptor_, buffer.data(), buffer.size());
+        if (length <= 0) return false;
+
+        for (ssize_t offset = 0; offset < length;) {
+            const auto *event = reinterpret_cast<const inotify_event *>(buffer.data() + offset);
+            offset += static_cast<ssize_t>(sizeof(inotify_event) + event->len);
+
+            const auto directory = directories_.find(event->wd);
+            if (directory == directories_.end() || event->len == 0) continue;
+
+            const auto path = directory->second / event->name;
+            if (is_ignored(path)) continue;
+
+            const bool structural = event->mask & (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO);
+            changes.structural |= structural;
+
+            if (event->mask & IN_ISDIR) {
+                if (event->mask & (IN_CREATE | IN_MOVED_TO)) add_recursive_watch(path);
+                continue;
+            }
+
+            changes.files.push_back(normalize_graph_path(path.lexically_relative(root_).generic_string()));
+        }
+
+        return true;
+    }
+
+    fs::path root_;
+    int descriptor_ = -1;
+    std::unordered_map<int, fs::path> directories_;
+};
+
+#endif
+
+} // namespace detail
+
+} // namespace talon
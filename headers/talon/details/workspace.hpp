@@ -4,16 +4,28 @@
 #define TALON_API
 #endif
 
+#include <chrono>
 #include <format>
 #include <fstream>
+#include <map>
+#include <iterator>
 #include <memory>
+#include <ranges>
 #include <sstream>
 #include <string>
+#include <system_error>
+#include <thread>
+#include <unordered_set>
 #include <vector>
 
 #include "build_options.hpp"
 #include "builder.hpp"
+#include "dependency_cache.hpp"
+#include "dependency_graph.hpp"
+#include "function_trace.hpp"
 #include "helpers.hpp"
+#include "size_report.hpp"
+#include "watcher.hpp"
 
 namespace talon {
 
@@ -22,8 +34,48 @@ namespace detail {
 template <typename T>
 concept string_view_implicit = std::same_as<std::decay_t<T>, const char *> || std::same_as<std::decay_t<T>, std::string_view>;
 
+struct test_edges {
+    std::string name;
+    std::string output;
+    test_framework framework;
+    std::vector<compile_edge> objects;
+};
+
+struct benchmark_edges {
+    std::string name;
+    std::string output;
+    benchmark_format format;
+    std::vector<compile_edge> objects;
+};
+
 } // namespace detail
 
+// test executables are linked from their own files, plus the workspace output when that is a library
+struct test_target {
+    std::string_view name;
+    test_framework framework = test_framework::plain;
+    std::vector<std::string_view> files;
+};
+
+// benchmark executables link like test executables, 'talon bench' builds them with optimizations and runs them
+struct benchmark_target {
+    std::string_view name;
+    benchmark_format format = benchmark_format::lines;
+    std::vector<std::string_view> files;
+};
+
+// a code generation step (protoc, flatc, embedded resources) that ninja runs in parallel with the compiles. generated
+// sources are compiled and linked like any other source, and every compile waits for all outputs to exist
+// (order-only), the generated headers a source actually includes are tracked through its depfile from then on.
+// outputs the command leaves untouched do not rebuild their dependents (restat), which needs a generator that
+// skips writing unchanged files, or writes to a temporary and only moves it over when it differs
+struct generator_target {
+    std::string_view command; // ninja syntax, $in and $out expand to the inputs and outputs
+    std::vector<std::string_view> inputs;
+    std::vector<std::string_view> outputs;
+    std::string_view description = "Generating $out";
+};
+
 struct workspace {
     build_options options = {};
     fs::path root = fs::current_path();
@@ -37,6 +89,12 @@ struct workspace {
     std::vector<std::string_view> library_files;
     std::vector<std::string_view> additional_linker_flags;
 
+    std::vector<test_target> test_targets;
+    std::vector<benchmark_target> benchmark_targets;
+    std::vector<generator_target> generators;
+    std::vector<dependency_target> dependencies;
+    std::vector<std::string_view> compile_workers;
+
     std::string_view windows_resource_file;
 
     template <detail::string_view_implicit... Args>
@@ -81,6 +139,39 @@ struct workspace {
         (additional_linker_flags.push_back(std::forward<Args>(flags)), ...);
     }
 
+    template <detail::string_view_implicit... Args>
+    inline TALON_API auto add_test(std::string_view name, test_framework framework, Args &&...files) -> void
+    {
+        test_targets.push_back({.name = name, .framework = framework, .files = {std::string_view{std::forward<Args>(files)}...}});
+    }
+
+    template <detail::string_view_implicit... Args>
+    inline TALON_API auto add_benchmark(std::string_view name, benchmark_format format, Args &&...files) -> void
+    {
+        benchmark_targets.push_back({.name = name, .format = format, .files = {std::string_view{std::forward<Args>(files)}...}});
+    }
+
+    // workspace.add_generator({.command = "protoc --cpp_out=build/generated $in", .inputs = {"proto/a.proto"},
+    //                         .outputs = {"build/generated/proto/a.pb.cc", "build/generated/proto/a.pb.h"}});
+    inline TALON_API auto add_generator(generator_target generator) -> void
+    {
+        generators.push_back(std::move(generator));
+    }
+
+    // workspace.add_dependency({.name = "fmt", .root = "third_party/fmt", .source_directories = {"src"},
+    //                          .include_directories = {"include"}});
+    inline TALON_API auto add_dependency(dependency_target dependency) -> void
+    {
+        dependencies.push_back(std::move(dependency));
+    }
+
+    // workers started with 'talon worker --listen <endpoint>', either unix:/path/to/socket or tcp:host:port
+    template <detail::string_view_implicit... Args>
+    inline TALON_API auto add_compile_workers(Args &&...endpoints) noexcept -> void
+    {
+        (compile_workers.push_back(std::forward<Args>(endpoints)), ...);
+    }
+
     constexpr auto set_windows_resource_file(std::string_view path) noexcept -> void
     {
         if constexpr (os == platform::windows_os) windows_resource_file = path;
@@ -103,27 +194,111 @@ struct workspace {
             fprintf(stderr, "[talon] warning: debug symbols enabled, forcing optimization to debug level\n");
         }
 
+        if (!compile_workers.empty() && options.compiler == compilers::msvc) {
+            fprintf(stderr, "[talon] warning: distributed compilation is not supported with MSVC, compiling locally\n");
+            compile_workers.clear();
+        }
+
+        if (options.instrumentation != instrumentation_mode::none && options.compiler == compilers::msvc) {
+            fprintf(stderr, "[talon] error: instrumentation is not supported with MSVC\n");
+            std::exit(1);
+        }
+
+        if (options.instrumentation == instrumentation_mode::xray && options.compiler != compilers::clang) {
+            fprintf(stderr, "[talon] error: xray instrumentation requires clang, use instrumentation_mode::functions with gcc\n");
+            std::exit(1);
+        }
+
+        if (!options.allocator_library.empty() && !fs::is_regular_file(options.allocator_library)) {
+            fprintf(stderr, "[talon] error: allocator library not found: %.*s\n", static_cast<int>(options.allocator_library.size()),
+                    options.allocator_library.data());
+            std::exit(1);
+        }
+
+        // ninja rejects an edge without outputs, and its error does not say which generator it came from
+        for (const auto &generator : generators) {
+            if (generator.command.empty() || generator.outputs.empty()) {
+                const auto first_input = generator.inputs.empty() ? std::string_view{"<no inputs>"} : generator.inputs.front();
+                fprintf(stderr, "[talon] error: generator for %.*s needs a command and at least one output\n",
+                        static_cast<int>(first_input.size()), first_input.data());
+                std::exit(1);
+            }
+        }
+
+        // timings of a debug build say little about the release one. the optimized build gets its own directory, so
+        // it neither replaces the debug build nor forces a full rebuild of it on the next 'talon build'
+        const bool build_benchmarks = std::getenv("TALON_BUILD_BENCHMARKS") != nullptr;
+        if (build_benchmarks && options.optimization == optimize_level::debug) {
+            options.optimization = optimize_level::speed;
+            output_directory = "build/bench/";
+            printf("[talon] benchmarking, building with optimizations into %s\n", output_directory.c_str());
+        }
+
         add_file_extension(output_name, options.output_type);
-        const auto build_script = create_build_script();
+        write_instrumentation_files();
 
-        if (options.print_build_script) printf("--- build.ninja ---\n%s\n-------------------\n", build_script.data());
+        auto phase_started = std::chrono::steady_clock::now();
+        prepare_dependencies();
+        detail::record_phase_time("dependencies", phase_started);
 
-        const auto cache_directory = root / ".talon/";
-        if (!fs::exists(cache_directory)) { fs::create_directory(cache_directory); }
+        phase_started = std::chrono::steady_clock::now();
+        auto compile_edges = collect_compile_edges();
+        detail::record_phase_time("collect_sources", phase_started);
 
-        const auto build_directory = root / "build/";
+        // tests only get built (and end up in the manifest) when 'talon test' asks for them
+        const bool build_tests = std::getenv("TALON_BUILD_TESTS") != nullptr;
+        const auto test_edges = build_tests ? collect_test_edges() : std::vector<detail::test_edges>{};
+        const auto benchmark_edges = build_benchmarks ? collect_benchmark_edges() : std::vector<detail::benchmark_edges>{};
+
+        const auto build_directory = root / output_directory;
         if (!fs::exists(build_directory / "objects")) { fs::create_directories(build_directory / "objects"); }
 
-        std::ofstream{cache_directory / "build.ninja"} << build_script;
-        if (std::system("ninja -f .talon/build.ninja") != 0) {
+        phase_started = std::chrono::steady_clock::now();
+        write_build_script(compile_edges, test_edges, benchmark_edges);
+        detail::record_phase_time("write_manifest", phase_started);
+
+        std::vector<std::string> targets;
+        if (const auto changed_files = detail::changed_files_from_environment()) {
+            // the output is left alone, requesting it would make ninja bring every stale object up to date as well
+            targets = find_affected_targets(compile_edges, test_edges, *changed_files, detail::load_dependency_log(".talon/build.ninja"),
+                                            false);
+            if (targets.empty()) {
+                printf("[talon] no targets affected by the change\n");
+                if (build_tests) write_test_manifest(test_edges);
+                return;
+            }
+
+            printf("[talon] building %zu affected target(s)\n", targets.size());
+        }
+
+        // a broken initial build is no reason to stop watching, the next save might fix it
+        const bool watching = std::getenv("TALON_WATCH") != nullptr;
+        phase_started = std::chrono::steady_clock::now();
+        const bool built = run_ninja(targets);
+        detail::record_phase_time("ninja", phase_started);
+
+        if (built) {
+            if (build_tests) write_test_manifest(test_edges);
+            if (build_benchmarks) write_benchmark_manifest(benchmark_edges);
+            if (targets.empty() || std::ranges::contains(targets, output_directory + output_name)) {
+                printf("[talon] build successful: %s\n", (build_directory / output_name).string().c_str());
+            } else {
+                printf("[talon] affected targets built\n");
+            }
+            if (const char *limit = std::getenv("TALON_SIZE_REPORT")) print_size_report(compile_edges, std::strtoul(limit, nullptr, 10));
+        } else {
             fprintf(stderr, "[talon] error: build failed.\n");
-            std::exit(1);
+            if (!watching) std::exit(1);
         }
 
-        printf("[talon] build successful: %s\n", (build_directory / output_name).string().c_str());
+        if (watching) watch(std::move(compile_edges), test_edges);
     }
 
   private:
+    std::vector<detail::prebuilt_dependency> prebuilt_dependencies;
+    // objects and outputs, relative to the root
+    std::string output_directory = "build/";
+
     auto create_builder() const -> std::unique_ptr<build_script_builder>
     {
         return std::make_unique<ninja_builder>();
@@ -137,10 +312,491 @@ struct workspace {
             case output_mode::static_library: name += ".lib"; break;
             case output_mode::dynamic_library: name += ".dll"; break;
             }
+        } else if (type == output_mode::static_library) {
+            name += ".a";
+        }
+    }
+
+    TALON_API auto write_build_script(const std::vector<detail::compile_edge> &compile_edges,
+                                      const std::vector<detail::test_edges> &test_edges,
+                                      const std::vector<detail::benchmark_edges> &benchmark_edges = {}) const -> void
+    {
+        const auto build_script = create_build_script(compile_edges, test_edges, benchmark_edges);
+        if (options.print_build_script) printf("--- build.ninja ---\n%s\n-------------------\n", build_script.data());
+
+        const auto cache_directory = root / ".talon/";
+        if (!fs::exists(cache_directory)) { fs::create_directory(cache_directory); }
+
+        std::ofstream{cache_directory / "build.ninja"} << build_script;
+    }
+
+    // ar rewrites the whole archive on every call, updating one in place saves nothing and would keep members of
+    // deleted sources around. thin archives (T) only store paths to the objects, which is the cheap variant
+    TALON_API auto archive_statement() const -> std::string
+    {
+        return std::format("rm -f $out && $ar {} $out $in", options.thin_archives ? "rcsT" : "rcs");
+    }
+
+    // builds the given targets, or everything when there are none
+    TALON_API auto run_ninja(const std::vector<std::string> &targets) const -> bool
+    {
+        std::string ninja_command = "ninja -f .talon/build.ninja";
+
+        // ninja sizes its pool after the local cores, keep enough compiles in flight to saturate the workers too
+        if (!compile_workers.empty()) {
+            const auto cores = std::max(std::thread::hardware_concurrency(), 1u);
+            ninja_command += std::format(" -j {}", cores * (compile_workers.size() + 1));
+        }
+
+        for (const auto &target : targets) {
+            ninja_command += ' ' + detail::quote_shell_argument(target);
+        }
+
+        // our own output is buffered while ninja writes straight to the terminal (or to the driver's pipe)
+        fflush(stdout);
+        return std::system(ninja_command.c_str()) == 0;
+    }
+
+    // only the first project on this machine with a given configuration pays for compiling a dependency
+    TALON_API auto prepare_dependencies() -> void
+    {
+        prebuilt_dependencies.clear();
+        if (dependencies.empty()) return;
+
+        const auto compiler_id = detail::compiler_identity(options.compiler, root / ".talon/dependencies/compiler.txt");
+        for (const auto &dependency : dependencies) {
+            auto prebuilt = detail::prepare_dependency(dependency, options, compiler_id, root / ".talon");
+            if (!prebuilt) std::exit(1);
+
+            prebuilt_dependencies.push_back(std::move(*prebuilt));
+        }
+    }
+
+    static constexpr std::string_view function_trace_source = ".talon/function_trace.cc";
+
+    // tells 'talon profile' how the output was instrumented, and drops the trace runtime next to the build script
+    TALON_API auto write_instrumentation_files() const -> void
+    {
+        const auto cache_directory = root / ".talon/";
+        if (!fs::exists(cache_directory)) { fs::create_directory(cache_directory); }
+
+        const auto mode = [&]() -> std::string_view {
+            switch (options.instrumentation) {
+            case instrumentation_mode::none: return "none";
+            case instrumentation_mode::xray: return "xray";
+            case instrumentation_mode::functions: return "functions";
+            }
+
+            return "none";
+        }();
+
+        std::ofstream{cache_directory / "instrumentation.txt"} << mode << '\n' << output_directory << output_name << '\n';
+        if (options.instrumentation != instrumentation_mode::functions) return;
+
+        // only rewritten when it changed, a fresh timestamp would recompile it on every build
+        const auto runtime_path = root / function_trace_source;
+        std::string current;
+        if (std::ifstream stream{runtime_path}) current.assign(std::istreambuf_iterator<char>{stream}, {});
+        if (current != detail::function_trace_runtime) std::ofstream{runtime_path} << detail::function_trace_runtime;
+    }
+
+    // 'talon size', the given limit caps the rows of every table
+    TALON_API auto print_size_report(const std::vector<detail::compile_edge> &compile_edges, const size_t limit) const -> void
+    {
+        std::vector<std::string> objects;
+        for (const auto &edge : compile_edges) {
+            objects.push_back(edge.object);
+        }
+
+        const auto output = root / output_directory / output_name;
+        if (!detail::print_size_report(output, objects, root / ".talon/size_snapshot.txt", limit)) std::exit(1);
+    }
+
+    // the scanned sources, the rendered manifest and the deps log stay resident between rebuilds, a change only
+    // costs the ninja invocation for the targets it reaches
+    TALON_API auto watch(std::vector<detail::compile_edge> compile_edges, const std::vector<detail::test_edges> &test_edges) const -> void
+    {
+#if defined(__linux__)
+        detail::file_watcher watcher{root, watched_directories()};
+        if (!watcher.valid()) {
+            fprintf(stderr, "[talon] error: unable to initialize inotify\n");
+            std::exit(1);
+        }
+
+        const bool build_tests = !test_edges.empty();
+        auto dependency_log = detail::load_dependency_log(".talon/build.ninja");
+
+        printf("[talon] watching for changes\n");
+        fflush(stdout);
+
+        while (true) {
+            const auto changes = watcher.wait_for_changes(std::chrono::milliseconds{50});
+            if (std::ranges::contains(changes.files, "build.cc")) {
+                printf("[talon] build script changed, restarting\n");
+                fflush(stdout);
+                std::exit(detail::watch_restart_exit_code);
+            }
+
+            // a source that appeared or went away changes the manifest and the link line, so rebuild everything
+            bool full_rebuild = false;
+            if (changes.structural) {
+                auto rescanned_edges = collect_compile_edges();
+                if (rescanned_edges != compile_edges) {
+                    compile_edges = std::move(rescanned_edges);
+                    write_build_script(compile_edges, test_edges);
+                    full_rebuild = true;
+                }
+            }
+
+            std::vector<std::string> targets;
+            if (!full_rebuild) {
+                targets = find_affected_targets(compile_edges, test_edges, changes.files, dependency_log, true);
+                if (targets.empty()) continue;
+            }
+
+            if (run_ninja(targets)) {
+                if (build_tests) write_test_manifest(test_edges);
+                printf("[talon] build successful: %s\n", (output_directory + output_name).c_str());
+            } else {
+                fprintf(stderr, "[talon] error: build failed.\n");
+            }
+
+            fflush(stdout);
+
+            // refreshed while idle, so it is ready when the next change comes in
+            dependency_log = detail::load_dependency_log(".talon/build.ninja");
+        }
+#else
+        (void)compile_edges;
+        (void)test_edges;
+        fprintf(stderr, "[talon] error: watch mode is only supported on linux\n");
+        std::exit(1);
+#endif
+    }
+
+    // sources, includes and the directories of individually added files, anything outside of the root is left alone
+    TALON_API auto watched_directories() const -> std::vector<fs::path>
+    {
+        std::vector<fs::path> directories;
+        auto add_directory = [&](const fs::path &directory) {
+            const auto relative = (root / directory).lexically_normal().lexically_relative(root);
+            if (relative.empty() || *relative.begin() == "..") return;
+            if (!std::ranges::contains(directories, relative)) directories.push_back(relative);
+        };
+
+        for (const auto &path : build_file_search_paths) {
+            add_directory(path);
+        }
+
+        for (const auto &path : include_directories) {
+            add_directory(path);
+        }
+
+        for (const auto &file : build_files) {
+            add_directory(fs::path{file}.parent_path());
+        }
+
+        for (const auto &test : test_targets) {
+            for (const auto &file : test.files) {
+                add_directory(fs::path{file}.parent_path());
+            }
+        }
+
+        for (const auto &benchmark : benchmark_targets) {
+            for (const auto &file : benchmark.files) {
+                add_directory(fs::path{file}.parent_path());
+            }
+        }
+
+        for (const auto &generator : generators) {
+            for (const auto &input : generator.inputs) {
+                add_directory(fs::path{input}.parent_path());
+            }
+        }
+
+        return directories;
+    }
+
+    TALON_API auto make_compile_edge(const fs::path &source) const -> detail::compile_edge
+    {
+        auto object_path = source;
+        object_path.replace_extension((options.compiler == compilers::msvc) ? ".obj" : ".o");
+        return {.object = output_directory + "objects/" + object_path.string(), .source = source.string()};
+    }
+
+    TALON_API auto collect_compile_edges() const -> std::vector<detail::compile_edge>
+    {
+        auto all_source_files = detail::find_and_collect_files(root, build_file_search_paths);
+        for (const auto &file_sv : build_files) {
+            all_source_files.push_back(fs::path{file_sv});
+        }
+
+        // generated sources inside of a source directory get found by the scan as well once they exist
+        for (const auto &generator : generators) {
+            for (const auto &output : generator.outputs) {
+                const auto source = fs::path{output}.lexically_normal();
+                if (!detail::is_implementation_file(source)) continue;
+                const auto same_source = [&](const fs::path &file) { return file.lexically_normal() == source; };
+                const bool discovered = std::ranges::any_of(all_source_files, same_source);
+                if (!discovered) all_source_files.push_back(source);
+            }
+        }
+
+        std::vector<detail::compile_edge> edges;
+        edges.reserve(all_source_files.size());
+        for (const auto &file : all_source_files) {
+            edges.push_back(make_compile_edge(file));
+        }
+
+        if (options.instrumentation == instrumentation_mode::functions) edges.push_back(make_compile_edge(function_trace_source));
+        return edges;
+    }
+
+    TALON_API auto collect_test_edges() const -> std::vector<detail::test_edges>
+    {
+        const auto executable_extension = os == platform::windows_os ? ".exe" : "";
+
+        std::vector<detail::test_edges> edges;
+        edges.reserve(test_targets.size());
+        for (const auto &test : test_targets) {
+            auto &edge = edges.emplace_back();
+            edge.name = test.name;
+            edge.output = std::format("{}tests/{}{}", output_directory, test.name, executable_extension);
+            edge.framework = test.framework;
+
+            for (const auto &file : test.files) {
+                edge.objects.push_back(make_compile_edge(fs::path{file}));
+            }
+        }
+
+        return edges;
+    }
+
+    TALON_API auto collect_benchmark_edges() const -> std::vector<detail::benchmark_edges>
+    {
+        const auto executable_extension = os == platform::windows_os ? ".exe" : "";
+
+        std::vector<detail::benchmark_edges> edges;
+        edges.reserve(benchmark_targets.size());
+        for (const auto &benchmark : benchmark_targets) {
+            auto &edge = edges.emplace_back();
+            edge.name = benchmark.name;
+            edge.output = std::format("{}benchmarks/{}{}", output_directory, benchmark.name, executable_extension);
+            edge.format = benchmark.format;
+
+            for (const auto &file : benchmark.files) {
+                edge.objects.push_back(make_compile_edge(fs::path{file}));
+            }
+        }
+
+        return edges;
+    }
+
+    // what a test or benchmark executable links against besides its own objects
+    TALON_API auto test_link_input() const -> std::string
+    {
+        switch (options.output_type) {
+        case output_mode::executable: return {};
+        case output_mode::static_library: return output_directory + output_name;
+        case output_mode::dynamic_library: {
+            // msvc links against the import library that sits next to the dll
+            if (options.compiler == compilers::msvc) return output_directory + fs::path{output_name}.replace_extension(".lib").string();
+            return output_directory + output_name;
+        }
+        }
+
+        return {};
+    }
+
+    // read back by 'talon test', one 'name<tab>framework<tab>executable' line per test target
+    TALON_API auto write_test_manifest(const std::vector<detail::test_edges> &test_edges) const -> void
+    {
+        std::ofstream manifest{root / ".talon/tests.txt"};
+        for (const auto &test : test_edges) {
+            manifest << test.name << '\t' << to_string_view(test.framework) << '\t' << test.output << '\n';
+        }
+    }
+
+    // read back by 'talon bench', one 'name<tab>format<tab>executable' line per benchmark target
+    TALON_API auto write_benchmark_manifest(const std::vector<detail::benchmark_edges> &benchmark_edges) const -> void
+    {
+        std::ofstream manifest{root / ".talon/benchmarks.txt"};
+        for (const auto &benchmark : benchmark_edges) {
+            manifest << benchmark.name << '\t' << to_string_view(benchmark.format) << '\t' << benchmark.output << '\n';
+        }
+    }
+
+    // objects reachable from the changed files, plus the test executables that have to be relinked because of them and,
+    // with relink_output, the workspace output. tests linking a library output still pull it in through ninja
+    TALON_API auto find_affected_targets(const std::vector<detail::compile_edge> &edges, const std::vector<detail::test_edges> &test_edges,
+                                         const std::vector<std::string> &changed_files,
+                                         const std::optional<detail::dependency_log> &dependency_log, const bool relink_output) const
+        -> std::vector<std::string>
+    {
+        if (!dependency_log) {
+            fprintf(stderr, "[talon] warning: unable to read the ninja deps log, building everything\n");
+
+            std::vector<std::string> targets{output_directory + output_name};
+            for (const auto &test : test_edges) {
+                targets.push_back(test.output);
+            }
+
+            return targets;
+        }
+
+        auto targets = detail::find_affected_objects(edges, *dependency_log, changed_files);
+
+        const bool resource_changed = !windows_resource_file.empty() &&
+                                      std::ranges::contains(changed_files, detail::normalize_graph_path(windows_resource_file));
+        // regenerated headers can reach any object, the deps log only knows which ones once they were built
+        const bool generator_changed = std::ranges::any_of(generators, [&](const generator_target &generator) {
+            return std::ranges::any_of(generator.inputs, [&](std::string_view input) {
+                return std::ranges::contains(changed_files, detail::normalize_graph_path(input));
+            });
+        });
+
+        const bool output_affected = !targets.empty() || resource_changed || generator_changed;
+        // which objects a generator change reaches is only known after building, the output reaches all of them
+        if (output_affected && (relink_output || generator_changed)) targets.push_back(output_directory + output_name);
+
+        const bool tests_link_output = !test_link_input().empty();
+        for (const auto &test : test_edges) {
+            const auto affected_objects = detail::find_affected_objects(test.objects, *dependency_log, changed_files);
+            if (affected_objects.empty() && !(output_affected && tests_link_output)) continue;
+
+            targets.insert(targets.end(), affected_objects.begin(), affected_objects.end());
+            targets.push_back(test.output);
+        }
+
+        return targets;
+    }
+
+    // test and benchmark executables, given as detail::test_edges or detail::benchmark_edges. a target may share
+    // sources with the workspace or with other targets, emitted_objects makes sure every object only gets one edge
+    template <typename Edges>
+    TALON_API auto add_executable_edges(build_script_builder &builder, std::unordered_set<std::string> &emitted_objects,
+                                        std::string_view rule_name, std::string_view description, const std::vector<Edges> &edges) const
+        -> void
+    {
+        const auto generated = generated_order_only_input();
+
+        // executables in build/tests and build/benchmarks find the shared library one directory up
+        if (options.compiler == compilers::msvc) {
+            builder.add_rule(rule_name, "$cxx /Fe$out $in $lflags", description);
+        } else if (os == platform::linux_os && options.output_type == output_mode::dynamic_library) {
+            builder.add_rule(rule_name, "$cxx $in -o $out $lflags '-Wl,-rpath,$$ORIGIN/..'", description);
+        } else {
+            builder.add_rule(rule_name, "$cxx $in -o $out $lflags", description);
+        }
+
+        const auto library_input = test_link_input();
+        for (const auto &target : edges) {
+            std::string link_inputs;
+            for (const auto &edge : target.objects) {
+                if (emitted_objects.insert(edge.object).second) builder.add_build_edge(edge.object, "compile", edge.source, "", generated);
+                link_inputs += ' ' + edge.object;
+            }
+
+            if (!library_input.empty()) link_inputs += ' ' + library_input;
+            builder.add_build_edge(target.output, rule_name, link_inputs);
+        }
+    }
+
+    // compiles depend order-only on this phony target, so nothing gets compiled before every generator ran once
+    [[nodiscard]] TALON_API auto generated_order_only_input() const -> std::string_view
+    {
+        return generators.empty() ? std::string_view{} : "talon_generated";
+    }
+
+    TALON_API auto add_generator_edges(build_script_builder &builder) const -> void
+    {
+        std::string all_outputs;
+        for (std::size_t index = 0; index < generators.size(); ++index) {
+            const auto &generator = generators[index];
+
+            std::string inputs;
+            for (const auto &input : generator.inputs) {
+                inputs += ' ' + std::string{input};
+            }
+
+            std::string outputs;
+            for (const auto &output : generator.outputs) {
+                if (!outputs.empty()) outputs += ' ';
+                outputs += output;
+            }
+
+            // a rule per generator, ninja variables can not be set per edge through the builder
+            const auto rule_name = std::format("generate_{}", index);
+            builder.add_rule(rule_name, generator.command, generator.description, "", "", true);
+            builder.add_build_edge(outputs, rule_name, inputs);
+            all_outputs += ' ' + outputs;
+        }
+
+        builder.add_build_edge(generated_order_only_input(), "phony", all_outputs);
+    }
+
+    // the driver preprocesses locally and ships the result to the least loaded worker, it writes the same depfile
+    // the local rule would, so the deps log and affected builds keep working
+    TALON_API auto remote_compile_statement() const -> std::string
+    {
+        if (compile_workers.empty()) return {};
+
+        const char *talon_executable = std::getenv("TALON_EXECUTABLE");
+        if (talon_executable == nullptr) {
+            fprintf(stderr, "[talon] warning: builder was not started by talon, compiling locally\n");
+            return {};
         }
+
+        std::string workers;
+        for (const auto &endpoint : compile_workers) {
+            if (!workers.empty()) workers += ',';
+            workers += endpoint;
+        }
+
+        return std::format("\"{}\" remote-compile --workers {} --input $in --output $out --depfile $out.d -- $cxx $cflags",
+                           talon_executable, workers);
     }
 
-    TALON_API auto create_build_script() const -> std::string
+    [[nodiscard]] TALON_API auto uses_split_linking() const -> bool
+    {
+        return options.split_linking && options.output_type == output_mode::executable && options.optimization == optimize_level::debug &&
+               options.link_mode != link_mode::statically && options.compiler != compilers::msvc && os == platform::linux_os;
+    }
+
+    // sources under src/<directory>/ end up in build/lib<directory>.so, everything else stays in the executable
+    [[nodiscard]] TALON_API auto split_link_partitions(const std::vector<detail::compile_edge> &compile_edges) const
+        -> std::map<std::string, std::vector<std::string>>
+    {
+        std::map<std::string, std::vector<std::string>> partitions;
+        for (const auto &edge : compile_edges) {
+            const auto source = fs::path{edge.source}.lexically_normal();
+            auto component = source.begin();
+            if (component == source.end() || *component != "src" || ++component == source.end()) continue;
+
+            const auto directory = *component;
+            if (std::next(component) == source.end()) continue;
+
+            partitions[output_directory + "lib" + directory.string() + ".so"].push_back(edge.object);
+        }
+
+        return partitions;
+    }
+
+    // the executable depends on a table of each library's exported symbols instead of the library itself, the table
+    // is only rewritten when the exports change (restat), so editing a function body relinks just its library
+    static TALON_API auto add_split_link_rules(build_script_builder &builder) -> void
+    {
+        // without a soname the executable would record the library by its path relative to the project root
+        builder.add_rule("link_split_lib", "$cxx -shared $in -o $out -Wl,-soname,$$(basename $out) $lflags", "Linking shared library $out");
+        builder.add_rule("split_lib_toc",
+                         "nm -D --defined-only -P $in | cut -d' ' -f1,2 > $out.tmp && "
+                         "if cmp -s $out.tmp $out; then rm $out.tmp; else mv $out.tmp $out; fi",
+                         "Reading exports of $in", "", "", true);
+    }
+
+    TALON_API auto create_build_script(const std::vector<detail::compile_edge> &compile_edges,
+                                       const std::vector<detail::test_edges> &test_edges,
+                                       const std::vector<detail::benchmark_edges> &benchmark_edges) const -> std::string
     {
         auto builder = create_builder();
 
@@ -149,15 +805,25 @@ struct workspace {
 
         std::string cflags;
         cflags += detail::parse_compile_flags(options);
+        const bool position_independent = options.output_type == output_mode::dynamic_library || uses_split_linking();
+        if (position_independent && os == platform::linux_os && options.compiler != compilers::msvc) cflags += "-fPIC ";
+
         cflags += detail::cpp_version_to_statement(options.compiler, options.cpp_version) + " ";
         cflags += detail::format_include_directories(include_directories, options.compiler);
         cflags += detail::format_preprocessor_definitions(preprocessor_definitions);
+        for (const auto &dependency : prebuilt_dependencies) {
+            cflags += (options.compiler == compilers::msvc ? " /I" : " -isystem") + dependency.include_directory.string();
+        }
+
         builder->add_variable("cflags", cflags);
 
         std::string lflags;
         lflags += detail::parse_link_flags(options);
         lflags += detail::format_library_directories(library_include_directories, options.compiler);
         lflags += detail::format_library_files(library_files, options.compiler);
+        for (const auto &dependency : prebuilt_dependencies) {
+            if (!dependency.library.empty()) lflags += dependency.library.string() + ' ';
+        }
         for (const auto &flag : additional_linker_flags) {
             lflags += std::string{flag} + ' ';
         }
@@ -170,7 +836,10 @@ struct workspace {
         const bool has_icon = !windows_resource_file.empty();
 
         if (options.compiler == compilers::msvc) {
-            builder->add_rule("compile", "$cxx /nologo /EHsc /Fo$out /Fd:build/vc140.pdb /c $in $cflags /FS /showIncludes /Zc:__cplusplus",
+            // one pdb per output directory, a benchmark build must not write into the debug build's
+            builder->add_rule("compile",
+                              std::format("$cxx /nologo /EHsc /Fo$out /Fd:{}vc140.pdb /c $in $cflags /FS /showIncludes /Zc:__cplusplus",
+                                          output_directory),
                               "Compiling $in", ".talon/$out.d", "msvc");
 
             if (has_icon) builder->add_rule("compile_rc", "rc.exe /nologo /fo$out $in", "Compiling resource $in");
@@ -194,34 +863,101 @@ struct workspace {
                 break;
             }
             }
-        }
+        } else {
+            // -MD rather than -MMD, includes are passed as -isystem and would otherwise be missing from the deps log
+            const auto remote_compile = remote_compile_statement();
+            if (remote_compile.empty()) {
+                builder->add_rule("compile", "$cxx -MD -MF $out.d $cflags -c $in -o $out", "Compiling $in", "$out.d", "gcc");
+            } else {
+                builder->add_rule("compile", remote_compile, "Compiling $in", "$out.d", "gcc");
+            }
 
-        std::stringstream link_inputs_stream;
-        const auto object_extension = (options.compiler == compilers::msvc) ? ".obj" : ".o";
+            switch (options.output_type) {
+            case output_mode::executable: {
+                link_rule_name = "link_exe";
+                if (uses_split_linking()) {
+                    // the libraries reference each other, --as-needed would drop the ones the executable does not use itself.
+                    // -rdynamic exports everything that stays in the executable (the src/ root objects, the function trace
+                    // hooks), a library relinked alone may start calling code the last executable link did not export
+                    builder->add_rule(link_rule_name,
+                                      "$cxx $in -o $out -rdynamic -Wl,--push-state,--no-as-needed $split_libraries -Wl,--pop-state "
+                                      "$lflags '-Wl,-rpath,$$ORIGIN'",
+                                      "Linking executable $out");
+                } else {
+                    builder->add_rule(link_rule_name, "$cxx $in -o $out $lflags", "Linking executable $out");
+                }
+                break;
+            }
 
-        auto all_source_files = detail::find_and_collect_files(root, build_file_search_paths);
-        for (const auto &file_sv : build_files) {
-            all_source_files.push_back(fs::path{file_sv});
+            case output_mode::static_library: {
+                link_rule_name = "link_static_lib";
+                builder->add_variable("ar", detail::archiver_to_statement(options.compiler));
+                builder->add_rule(link_rule_name, archive_statement(), "Archiving static library $out");
+                break;
+            }
+
+            case output_mode::dynamic_library: {
+                link_rule_name = "link_shared_lib";
+                builder->add_rule(link_rule_name, "$cxx -shared $in -o $out $lflags", "Linking shared library $out");
+                break;
+            }
+            }
         }
 
-        for (const auto &file : all_source_files) {
-            auto object_path = file;
-            object_path.replace_extension(object_extension);
-            const auto object_output = "build/objects/" + object_path.string();
+        if (!generators.empty()) add_generator_edges(*builder);
+        const auto generated = generated_order_only_input();
+
+        std::unordered_set<std::string> split_objects;
+        std::string split_tables;
+        if (uses_split_linking()) {
+            const auto partitions = split_link_partitions(compile_edges);
+
+            std::string split_libraries;
+            for (const auto &library : partitions | std::views::keys) {
+                split_libraries += library + ' ';
+                split_tables += library + ".toc ";
+            }
+
+            builder->add_variable("split_libraries", split_libraries);
+            add_split_link_rules(*builder);
+
+            for (const auto &[library, objects] : partitions) {
+                std::string library_inputs;
+                for (const auto &object : objects) {
+                    library_inputs += ' ' + object;
+                    split_objects.insert(object);
+                }
 
-            builder->add_build_edge(object_output, "compile", file.string());
-            link_inputs_stream << " " << object_output;
+                builder->add_build_edge(library, "link_split_lib", library_inputs);
+                builder->add_build_edge(library + ".toc", "split_lib_toc", library);
+            }
+        }
+
+        std::stringstream link_inputs_stream;
+        for (const auto &edge : compile_edges) {
+            builder->add_build_edge(edge.object, "compile", edge.source, "", generated);
+            if (!split_objects.contains(edge.object)) link_inputs_stream << " " << edge.object;
         }
 
         // TODO icon support for other platforms
         if (os == platform::windows_os && has_icon) {
-            const auto res_output = "build/" + fs::path{windows_resource_file}.stem().string() + ".res";
+            const auto res_output = output_directory + fs::path{windows_resource_file}.stem().string() + ".res";
             builder->add_build_edge(res_output, "compile_rc", windows_resource_file);
             link_inputs_stream << " " << res_output;
         }
 
-        const auto final_output = "build/" + output_name;
-        builder->add_build_edge(final_output, link_rule_name, link_inputs_stream.str());
+        const auto final_output = output_directory + output_name;
+        builder->add_build_edge(final_output, link_rule_name, link_inputs_stream.str(), split_tables);
+
+        std::unordered_set<std::string> emitted_objects;
+        for (const auto &edge : compile_edges) {
+            emitted_objects.insert(edge.object);
+        }
+
+        if (!test_edges.empty()) add_executable_edges(*builder, emitted_objects, "link_test", "Linking test $out", test_edges);
+        if (!benchmark_edges.empty()) {
+            add_executable_edges(*builder, emitted_objects, "link_benchmark", "Linking benchmark $out", benchmark_edges);
+        }
 
         return builder->get_script();
     }
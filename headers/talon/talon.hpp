@@ -14,6 +14,8 @@ using enum compilers;
 using enum output_mode;
 using enum cpp_versions;
 using enum optimize_level;
+using enum test_framework;
+using enum benchmark_format;
 
 } // namespace talon
 
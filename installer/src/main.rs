@@ -156,6 +156,12 @@ fn main() {
 
         let mut cmd = create_symlink_to_headers(&headers_directory);
         cmd.status().expect("failed to create symlink to headers");
+
+        // build scripts are compiled against a pch of the talon headers, building it now saves the first build
+        let status = Command::new(&executable_path).arg("precompile").status();
+        if !matches!(status, Ok(status) if status.success()) {
+            println!("failed to precompile the talon headers, they will be precompiled on first use");
+        }
     }
 
     println!("\npress enter to exit...");